@@ -0,0 +1,229 @@
+/**********************************************************************
+ *
+ * PROJECT:		Types library
+ * FILE:		Atom.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		A string interning table. Every distinct string is
+ *				stored once and identified by a dense uint32 atom,
+ *				which can be compared directly and used as a tree key.
+ *
+ *				(c) Tuomo Jauhiainen 2012
+ *
+ **********************************************************************/
+
+#include "Types/Atom.h"
+#include <malloc.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ATOM_MIN_CAPACITY	(64)	// Initial size of the strings array
+
+/*
+ * __atom_alloc - An allocator func with further error
+ * checking. Exits the app if allocating fails.
+ * @arg size: Size to be allocated in bytes
+ * @returns: A pointer to the allocated memory block
+ */
+static void* __atom_alloc( size_t size )
+{
+	void* ptr;
+
+	ptr = malloc( size );
+
+	assert( ptr != NULL ); // If we're in debug mode trigger the assertion
+	if ( ptr ) return ptr;
+
+	exit( EXIT_FAILURE ); // Otherwise exit the application just in case
+}
+
+/*
+ * __atom_free - A memory freeing func.
+ * @arg ptr: Memory block to be freed.
+ */
+static void __atom_free( const void* ptr )
+{
+	free( (void*)ptr );
+}
+
+/*
+ * __atom_key_dup - Key duplication func of the table map. The keys are already
+ * stored in the string arena, so the map simply points to them.
+ * @arg key: The key in the arena
+ * @returns: The key itself
+ */
+static void* __atom_key_dup( const void* key )
+{
+	return (void*)key;
+}
+
+/*
+ * __atom_key_free - Key freeing func of the table map. The arena owns the keys.
+ * @arg key: The key in the arena
+ */
+static void __atom_key_free( const void* key )
+{
+	UNREFERENCED_PARAM(key);
+}
+
+/*
+ * __atom_store - Copy a string into the arena. The strings never move,
+ * a new block is started when the newest one runs out of room.
+ * @arg table: Atom table
+ * @arg string: The string
+ * @arg size: Size of the string including the terminating NUL
+ * @returns: The copy in the arena
+ */
+static const char* __atom_store( atomtable_t* table, const char* string, size_t size )
+{
+	atomblock_t* block;
+	size_t block_size;
+	char* copy;
+
+	if ( size > table->left )
+	{
+		block_size = size > ATOM_BLOCK_SIZE - sizeof(atomblock_t) ? size : ATOM_BLOCK_SIZE - sizeof(atomblock_t);
+
+		block = __atom_alloc( sizeof(atomblock_t) + block_size );
+		block->next = table->blocks;
+
+		table->blocks = block;
+		table->cursor = (char*)( block + 1 );
+		table->left = block_size;
+	}
+
+	copy = table->cursor;
+	memcpy( copy, string, size );
+
+	table->cursor += size;
+	table->left -= size;
+
+	return copy;
+}
+
+/*
+ * atomtable_create - Create an empty atom table.
+ * @returns: The created table
+ */
+atomtable_t* atomtable_create( void )
+{
+	atomtable_t* table;
+	hashmap_key_funcs_t funcs;
+
+	table = __atom_alloc( sizeof(*table) );
+	memset( table, 0, sizeof(*table) );
+
+	// The map compares strings like a string map, but its keys live in the arena.
+	funcs = *hashmap_key_funcs( HASHMAP_KEY_STRING );
+	funcs.key_dup = __atom_key_dup;
+	funcs.key_free = __atom_key_free;
+	funcs.key_size = NULL;
+
+	table->map = hashmap_create( 0 );
+	hashmap_set_key_funcs( table->map, &funcs );
+	hashmap_set_small_keys( table->map, 0 );
+
+	table->capacity = ATOM_MIN_CAPACITY;
+	table->strings = __atom_alloc( sizeof(const char*) * table->capacity );
+
+	return table;
+}
+
+/*
+ * atomtable_destroy - Destroy an atom table and every string interned into it.
+ * @arg table: The table to be destroyed
+ */
+void atomtable_destroy( atomtable_t* table )
+{
+	atomblock_t *block, *next;
+
+	assert( table != NULL );
+
+	hashmap_destroy( table->map );
+
+	for ( block = table->blocks; block; block = next )
+	{
+		next = block->next;
+		__atom_free( block );
+	}
+
+	__atom_free( table->strings );
+	__atom_free( table );
+}
+
+/*
+ * atom_intern - Get the atom of a string, interning the string if needed.
+ * Atoms are handed out in order starting from 0.
+ * @arg table: Atom table
+ * @arg string: A NUL-terminated string
+ * @returns: The atom of the string
+ */
+atom_t atom_intern( atomtable_t* table, const char* string )
+{
+	const char** strings;
+	const char* copy;
+	uint32 hash;
+	void* found;
+
+	assert( table != NULL );
+	assert( string != NULL );
+
+	// The data of an entry is its atom plus one, so that atom 0 is not NULL.
+	hash = hashmap_hash_key( table->map, string );
+	found = hashmap_find_h( table->map, string, hash );
+
+	if ( found ) return (atom_t)( (size_t)found - 1 );
+
+	assert( table->count < ATOM_NONE );
+
+	if ( table->count == table->capacity )
+	{
+		strings = __atom_alloc( sizeof(const char*) * table->capacity * 2 );
+		memcpy( strings, table->strings, sizeof(const char*) * table->count );
+
+		__atom_free( table->strings );
+
+		table->strings = strings;
+		table->capacity *= 2;
+	}
+
+	copy = __atom_store( table, string, strlen( string ) + 1 );
+
+	table->strings[table->count] = copy;
+	hashmap_insert_h( table->map, copy, hash, (void*)( (size_t)table->count + 1 ) );
+
+	return table->count++;
+}
+
+/*
+ * atom_find - Get the atom of a string without interning it.
+ * @arg table: Atom table
+ * @arg string: A NUL-terminated string
+ * @returns: The atom of the string, ATOM_NONE if the string has not been interned
+ */
+atom_t atom_find( atomtable_t* table, const char* string )
+{
+	void* found;
+
+	assert( table != NULL );
+	assert( string != NULL );
+
+	found = hashmap_find( table->map, string );
+
+	return found ? (atom_t)( (size_t)found - 1 ) : ATOM_NONE;
+}
+
+/*
+ * atom_string - Get the string of an atom. The string stays valid
+ * until the table is destroyed.
+ * @arg table: Atom table
+ * @arg atom: The atom
+ * @returns: The interned string
+ */
+const char* atom_string( atomtable_t* table, atom_t atom )
+{
+	assert( table != NULL );
+	assert( atom < table->count );
+
+	return table->strings[atom];
+}
@@ -0,0 +1,51 @@
+/**********************************************************************
+ *
+ * PROJECT:		Types library
+ * FILE:		Atom.h
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		A string interning table. Every distinct string is
+ *				stored once and identified by a dense uint32 atom,
+ *				which can be compared directly and used as a tree key.
+ *
+ *				(c) Tuomo Jauhiainen 2012
+ *
+ **********************************************************************/
+
+#pragma once
+#ifndef __MYLLY_ATOM_H
+#define __MYLLY_ATOM_H
+
+#include "stdtypes.h"
+#include "HashMap.h"
+
+typedef uint32 atom_t;
+
+#define ATOM_NONE			( (atom_t)-1 )	// No atom, returned for strings which have not been interned
+#define ATOM_BLOCK_SIZE		(65536)			// Size of a block of the string arena
+
+typedef struct atomblock_s {
+	struct atomblock_s*	next;			// Previously allocated block
+} atomblock_t;
+
+typedef struct {
+	hashmap_t*			map;			// Interned strings mapped to their atoms
+	const char**		strings;		// Interned strings indexed by atom
+	uint32				count;			// Number of atoms handed out
+	uint32				capacity;		// Number of atoms the strings array has room for
+	atomblock_t*		blocks;			// Blocks of the string arena, the newest first
+	char*				cursor;			// Free space of the newest block
+	size_t				left;			// Bytes left at the cursor
+} atomtable_t;
+
+__BEGIN_DECLS
+
+MYLLY_API atomtable_t*		atomtable_create		( void );
+MYLLY_API void				atomtable_destroy		( atomtable_t* table );
+
+MYLLY_API atom_t			atom_intern				( atomtable_t* table, const char* string );
+MYLLY_API atom_t			atom_find				( atomtable_t* table, const char* string );
+MYLLY_API const char*		atom_string				( atomtable_t* table, atom_t atom );
+
+__END_DECLS
+
+#endif /* __MYLLY_ATOM_H */
@@ -0,0 +1,627 @@
+/**********************************************************************
+ *
+ * PROJECT:		Types library
+ * FILE:		Cache.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		A bounded LRU/LFU cache. Every entry is a single
+ *				allocation holding its hash chain link, its recency
+ *				links and a copy of its key.
+ *
+ *				(c) Tuomo Jauhiainen 2012
+ *
+ **********************************************************************/
+
+#include "Types/Cache.h"
+#include <malloc.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_MIN_BUCKETS	(16)	// Initial number of buckets of a cache without an entry capacity
+
+/*
+ * __cache_alloc - An allocator func with further error
+ * checking. Exits the app if allocating fails.
+ * @arg size: Size to be allocated in bytes
+ * @returns: A pointer to the allocated memory block
+ */
+static void* __cache_alloc( size_t size )
+{
+	void* ptr;
+
+	ptr = malloc( size );
+
+	assert( ptr != NULL ); // If we're in debug mode trigger the assertion
+	if ( ptr ) return ptr;
+
+	exit( EXIT_FAILURE ); // Otherwise exit the application just in case
+}
+
+/*
+ * __cache_free - A memory freeing func.
+ * @arg ptr: Memory block to be freed.
+ */
+static void __cache_free( const void* ptr )
+{
+	free( (void*)ptr );
+}
+
+/*
+ * __cache_buckets - Allocate an empty bucket array.
+ * @arg count: Number of buckets, a power of two
+ * @returns: The bucket array
+ */
+static cacheentry_t** __cache_buckets( uint32 count )
+{
+	cacheentry_t** buckets;
+
+	buckets = __cache_alloc( sizeof(cacheentry_t*) * count );
+	memset( buckets, 0, sizeof(cacheentry_t*) * count );
+
+	return buckets;
+}
+
+/*
+ * __cache_grow - Double the number of buckets.
+ * @arg cache: Cache
+ */
+static void __cache_grow( cache_t* cache )
+{
+	cacheentry_t** buckets;
+	cacheentry_t *entry, *next;
+	uint32 i, index, count;
+
+	count = cache->bucket_count * 2;
+	buckets = __cache_buckets( count );
+
+	for ( i = 0; i < cache->bucket_count; i++ )
+	{
+		for ( entry = cache->buckets[i]; entry; entry = next )
+		{
+			next = entry->next;
+			index = entry->hash & ( count - 1 );
+
+			entry->next = buckets[index];
+			buckets[index] = entry;
+		}
+	}
+
+	__cache_free( cache->buckets );
+
+	cache->buckets = buckets;
+	cache->bucket_count = count;
+}
+
+/*
+ * __cache_find_link - Find the link pointing to the entry of a key.
+ * @arg cache: Cache
+ * @arg key: The key
+ * @arg hash: Full hash of the key
+ * @returns: The link to the entry, or the empty link at the end of the bucket
+ */
+static MYLLY_INLINE cacheentry_t** __cache_find_link( cache_t* cache, const void* key, uint32 hash )
+{
+	cacheentry_t** link;
+
+	link = &cache->buckets[hash & ( cache->bucket_count - 1 )];
+
+	while ( *link && ( (*link)->hash != hash || !cache->key_equals( (*link)->key, key ) ) )
+		link = &(*link)->next;
+
+	return link;
+}
+
+/*
+ * __cache_list_push - Add an entry to a recency list as its most recently used entry.
+ * @arg list: The recency list
+ * @arg entry: The entry
+ */
+static MYLLY_INLINE void __cache_list_push( cachelist_t* list, cacheentry_t* entry )
+{
+	entry->newer = NULL;
+	entry->older = list->newest;
+
+	if ( list->newest ) list->newest->newer = entry;
+	else list->oldest = entry;
+
+	list->newest = entry;
+}
+
+/*
+ * __cache_list_unlink - Remove an entry from a recency list.
+ * @arg list: The recency list
+ * @arg entry: The entry
+ */
+static MYLLY_INLINE void __cache_list_unlink( cachelist_t* list, cacheentry_t* entry )
+{
+	if ( entry->newer ) entry->newer->older = entry->older;
+	else list->newest = entry->older;
+
+	if ( entry->older ) entry->older->newer = entry->newer;
+	else list->oldest = entry->newer;
+}
+
+/*
+ * __cache_freq_create - Create a use count group and link it after another group.
+ * @arg cache: Cache
+ * @arg prev: The group with the next lower use count, NULL to add the rarest group
+ * @arg count: Use count of the group
+ * @returns: The new group
+ */
+static cachefreq_t* __cache_freq_create( cache_t* cache, cachefreq_t* prev, uint32 count )
+{
+	cachefreq_t* group;
+
+	group = __cache_alloc( sizeof(*group) );
+
+	group->count = count;
+	group->entries.newest = NULL;
+	group->entries.oldest = NULL;
+	group->prev = prev;
+	group->next = prev ? prev->next : cache->rarest;
+
+	if ( group->next ) group->next->prev = group;
+
+	if ( prev ) prev->next = group;
+	else cache->rarest = group;
+
+	return group;
+}
+
+/*
+ * __cache_freq_remove - Free a use count group which has run out of entries.
+ * @arg cache: Cache
+ * @arg group: The group to be removed
+ */
+static void __cache_freq_remove( cache_t* cache, cachefreq_t* group )
+{
+	if ( group->prev ) group->prev->next = group->next;
+	else cache->rarest = group->next;
+
+	if ( group->next ) group->next->prev = group->prev;
+
+	__cache_free( group );
+}
+
+/*
+ * __cache_link - Add a new entry to the eviction order.
+ * @arg cache: Cache
+ * @arg entry: The new entry
+ */
+static void __cache_link( cache_t* cache, cacheentry_t* entry )
+{
+	if ( cache->policy == CACHE_LRU )
+	{
+		__cache_list_push( &cache->recent, entry );
+		return;
+	}
+
+	// New entries have been used once, which makes them the rarest ones.
+	if ( !cache->rarest || cache->rarest->count != 1 )
+		__cache_freq_create( cache, NULL, 1 );
+
+	entry->freq = cache->rarest;
+	__cache_list_push( &entry->freq->entries, entry );
+}
+
+/*
+ * __cache_unlink - Remove an entry from the eviction order.
+ * @arg cache: Cache
+ * @arg entry: The entry
+ */
+static void __cache_unlink( cache_t* cache, cacheentry_t* entry )
+{
+	if ( cache->policy == CACHE_LRU )
+	{
+		__cache_list_unlink( &cache->recent, entry );
+		return;
+	}
+
+	__cache_list_unlink( &entry->freq->entries, entry );
+
+	if ( !entry->freq->entries.newest )
+		__cache_freq_remove( cache, entry->freq );
+}
+
+/*
+ * __cache_touch - Mark an entry used. An LRU entry becomes the most recently used
+ * one, an LFU entry moves to the group of the next higher use count.
+ * @arg cache: Cache
+ * @arg entry: The used entry
+ */
+static MYLLY_INLINE void __cache_touch( cache_t* cache, cacheentry_t* entry )
+{
+	cachefreq_t *group, *next;
+
+	if ( cache->policy == CACHE_LRU )
+	{
+		if ( cache->recent.newest != entry )
+		{
+			__cache_list_unlink( &cache->recent, entry );
+			__cache_list_push( &cache->recent, entry );
+		}
+		return;
+	}
+
+	group = entry->freq;
+	next = group->next;
+
+	__cache_list_unlink( &group->entries, entry );
+
+	// Saturated use counts stay in their group and only refresh their recency.
+	if ( group->count == (uint32)-1 )
+	{
+		__cache_list_push( &group->entries, entry );
+		return;
+	}
+
+	if ( !next || next->count != group->count + 1 )
+		next = __cache_freq_create( cache, group, group->count + 1 );
+
+	entry->freq = next;
+	__cache_list_push( &next->entries, entry );
+
+	if ( !group->entries.newest )
+		__cache_freq_remove( cache, group );
+}
+
+/*
+ * __cache_entry_create - Create an entry. The key is copied right after the entry
+ * when its size is known, otherwise it is duplicated with the key functions.
+ * @arg cache: Cache
+ * @arg key: The key
+ * @arg hash: Full hash of the key
+ * @arg data: The data to be stored
+ * @arg size: Size of the entry, counted against the byte capacity
+ * @returns: The entry
+ */
+static cacheentry_t* __cache_entry_create( cache_t* cache, const void* key, uint32 hash, const void* data, size_t size )
+{
+	cacheentry_t* entry;
+	size_t len;
+
+	if ( cache->key_size )
+	{
+		len = cache->key_size( key );
+		entry = __cache_alloc( sizeof(*entry) + len );
+
+		memcpy( entry + 1, key, len );
+		entry->key = entry + 1;
+	}
+	else
+	{
+		entry = __cache_alloc( sizeof(*entry) );
+		entry->key = cache->key_dup( key );
+	}
+
+	entry->hash = hash;
+	entry->size = size;
+	entry->data = data;
+	entry->freq = NULL;
+
+	return entry;
+}
+
+/*
+ * __cache_entry_free - Free an entry and its key.
+ * @arg cache: Cache
+ * @arg entry: The entry
+ */
+static void __cache_entry_free( cache_t* cache, cacheentry_t* entry )
+{
+	if ( !cache->key_size )
+		cache->key_free( entry->key );
+
+	__cache_free( entry );
+}
+
+/*
+ * __cache_remove - Remove an entry from the cache without freeing it.
+ * @arg cache: Cache
+ * @arg entry: The entry
+ */
+static void __cache_remove( cache_t* cache, cacheentry_t* entry )
+{
+	cacheentry_t** link;
+
+	link = &cache->buckets[entry->hash & ( cache->bucket_count - 1 )];
+	while ( *link != entry ) link = &(*link)->next;
+
+	*link = entry->next;
+
+	__cache_unlink( cache, entry );
+
+	cache->size--;
+	cache->bytes -= entry->size;
+}
+
+/*
+ * __cache_trim - Evict entries until the cache has room for more.
+ * @arg cache: Cache
+ * @arg entries: Number of entries to make room for
+ * @arg bytes: Number of bytes to make room for
+ * @arg keep: An entry which must not be evicted, NULL for none
+ */
+static void __cache_trim( cache_t* cache, uint32 entries, size_t bytes, cacheentry_t* keep )
+{
+	cacheentry_t* victim;
+
+	while ( ( cache->max_entries && cache->size + entries > cache->max_entries ) ||
+			( cache->max_bytes && cache->bytes + bytes > cache->max_bytes ) )
+	{
+		if ( cache->policy == CACHE_LRU )
+			victim = cache->recent.oldest;
+		else
+			victim = cache->rarest ? cache->rarest->entries.oldest : NULL;
+
+		// The kept entry is skipped, the next one in the eviction order goes instead.
+		if ( victim != NULL && victim == keep )
+		{
+			victim = keep->newer;
+
+			if ( victim == NULL && cache->policy == CACHE_LFU && keep->freq->next )
+				victim = keep->freq->next->entries.oldest;
+		}
+
+		if ( victim == NULL ) break;
+
+		__cache_remove( cache, victim );
+
+		if ( cache->evict )
+			cache->evict( victim->key, victim->data );
+
+		__cache_entry_free( cache, victim );
+		cache->evictions++;
+	}
+}
+
+/*
+ * cache_create - Create an empty cache.
+ * @arg policy: Eviction policy
+ * @arg max_entries: Maximum number of entries, 0 for no limit
+ * @arg max_bytes: Maximum total size of the entries, 0 for no limit
+ * @arg keys: Type of the keys, selects the hash and comparison functions like for a hashmap_t
+ * @returns: The created cache
+ */
+cache_t* cache_create( cache_policy_t policy, uint32 max_entries, size_t max_bytes, hashmap_key_type_t keys )
+{
+	cache_t* cache;
+	uint32 buckets = CACHE_MIN_BUCKETS;
+
+	cache = __cache_alloc( sizeof(*cache) );
+	memset( cache, 0, sizeof(*cache) );
+
+	// A cache with an entry capacity never has to grow past it.
+	while ( buckets < max_entries && buckets < 0x80000000 )
+		buckets <<= 1;
+
+	cache->policy = policy;
+	cache->buckets = __cache_buckets( buckets );
+	cache->bucket_count = buckets;
+	cache->max_entries = max_entries;
+	cache->max_bytes = max_bytes;
+
+	cache_set_key_funcs( cache, hashmap_key_funcs( keys ) );
+
+	return cache;
+}
+
+/*
+ * cache_destroy - Destroy a cache. The evict function is called for every entry.
+ * @arg cache: The cache to be destroyed
+ */
+void cache_destroy( cache_t* cache )
+{
+	assert( cache != NULL );
+
+	cache_clear( cache );
+
+	__cache_free( cache->buckets );
+	__cache_free( cache );
+}
+
+/*
+ * cache_set_key_funcs - Set custom key functions of an empty cache. Keys with a
+ * key_size function are copied into their entries, others are duplicated.
+ * @arg cache: Cache
+ * @arg funcs: The key functions to use
+ */
+void cache_set_key_funcs( cache_t* cache, const hashmap_key_funcs_t* funcs )
+{
+	assert( cache != NULL );
+	assert( funcs != NULL );
+	assert( cache->size == 0 ); // Existing keys would be freed with the wrong functions
+
+	cache->key_hash = funcs->key_hash;
+	cache->key_equals = funcs->key_equals;
+	cache->key_dup = funcs->key_dup;
+	cache->key_free = funcs->key_free;
+	cache->key_size = funcs->key_size;
+}
+
+/*
+ * cache_set_evict_func - Set a function to be called for every entry dropped by
+ * the cache, whether it was evicted, cleared or left in a destroyed cache.
+ * Entries removed with cache_erase or replaced by cache_put are returned instead.
+ * @arg cache: Cache
+ * @arg evict: The function, NULL for none
+ */
+void cache_set_evict_func( cache_t* cache, cache_evict_func_t evict )
+{
+	assert( cache != NULL );
+
+	cache->evict = evict;
+}
+
+/*
+ * cache_get - Find the data matching a key and mark the entry used.
+ * @arg cache: Cache
+ * @arg key: Pointer to the key value. For pointer keys the pointer itself.
+ * @returns: Found data, or NULL if the key is not cached
+ */
+void* cache_get( cache_t* cache, const void* key )
+{
+	cacheentry_t* entry;
+
+	assert( cache != NULL );
+
+	entry = *__cache_find_link( cache, key, cache->key_hash( key ) );
+
+	if ( entry == NULL )
+	{
+		cache->misses++;
+		return NULL;
+	}
+
+	cache->hits++;
+	__cache_touch( cache, entry );
+
+	return (void*)entry->data;
+}
+
+/*
+ * cache_peek - Find the data matching a key without marking the entry used
+ * or updating the hit and miss counters.
+ * @arg cache: Cache
+ * @arg key: Pointer to the key value. For pointer keys the pointer itself.
+ * @returns: Found data, or NULL if the key is not cached
+ */
+void* cache_peek( cache_t* cache, const void* key )
+{
+	cacheentry_t* entry;
+
+	assert( cache != NULL );
+
+	entry = *__cache_find_link( cache, key, cache->key_hash( key ) );
+
+	return entry ? (void*)entry->data : NULL;
+}
+
+/*
+ * cache_put - Store data for a key and mark the entry used. Entries are evicted
+ * until the new one fits within the capacity, an entry larger than the byte
+ * capacity is still stored, but alone.
+ * @arg cache: Cache
+ * @arg key: Pointer to the key value. For pointer keys the pointer itself.
+ * @arg data: The data to be stored
+ * @arg size: Size of the entry, counted against the byte capacity
+ * @returns: Previous data assigned to this key, NULL if nothing was stored
+ */
+void* cache_put( cache_t* cache, const void* key, const void* data, size_t size )
+{
+	cacheentry_t* entry;
+	void* old;
+	uint32 hash, index;
+
+	assert( cache != NULL );
+
+	hash = cache->key_hash( key );
+	entry = *__cache_find_link( cache, key, hash );
+
+	if ( entry )
+	{
+		old = (void*)entry->data;
+
+		cache->bytes = cache->bytes - entry->size + size;
+		entry->size = size;
+		entry->data = data;
+
+		__cache_touch( cache, entry );
+		__cache_trim( cache, 0, 0, entry );
+
+		return old;
+	}
+
+	// Room is made before the entry is added, so a new LFU entry is never its own victim.
+	__cache_trim( cache, 1, size, NULL );
+
+	entry = __cache_entry_create( cache, key, hash, data, size );
+	index = hash & ( cache->bucket_count - 1 );
+
+	entry->next = cache->buckets[index];
+	cache->buckets[index] = entry;
+
+	__cache_link( cache, entry );
+
+	cache->size++;
+	cache->bytes += size;
+
+	if ( cache->size > cache->bucket_count )
+		__cache_grow( cache );
+
+	return NULL;
+}
+
+/*
+ * cache_erase - Remove a key and its data from the cache.
+ * The evict function is not called for the removed entry.
+ * @arg cache: Cache
+ * @arg key: Pointer to the key value. For pointer keys the pointer itself.
+ * @returns: Removed data, NULL if the key was not cached
+ */
+void* cache_erase( cache_t* cache, const void* key )
+{
+	cacheentry_t* entry;
+	void* data;
+
+	assert( cache != NULL );
+
+	entry = *__cache_find_link( cache, key, cache->key_hash( key ) );
+	if ( entry == NULL ) return NULL;
+
+	data = (void*)entry->data;
+
+	__cache_remove( cache, entry );
+	__cache_entry_free( cache, entry );
+
+	return data;
+}
+
+/*
+ * cache_clear - Remove every entry from the cache. The evict function is called
+ * for every entry, the eviction counter is left untouched.
+ * @arg cache: Cache
+ */
+void cache_clear( cache_t* cache )
+{
+	cacheentry_t *entry, *next;
+	uint32 i;
+
+	assert( cache != NULL );
+
+	for ( i = 0; i < cache->bucket_count; i++ )
+	{
+		for ( entry = cache->buckets[i]; entry; entry = next )
+		{
+			next = entry->next;
+
+			if ( cache->evict )
+				cache->evict( entry->key, entry->data );
+
+			__cache_entry_free( cache, entry );
+		}
+
+		cache->buckets[i] = NULL;
+	}
+
+	while ( cache->rarest )
+		__cache_freq_remove( cache, cache->rarest );
+
+	cache->recent.newest = NULL;
+	cache->recent.oldest = NULL;
+	cache->size = 0;
+	cache->bytes = 0;
+}
+
+/*
+ * cache_reset_counters - Reset the hit, miss and eviction counters.
+ * @arg cache: Cache
+ */
+void cache_reset_counters( cache_t* cache )
+{
+	assert( cache != NULL );
+
+	cache->hits = 0;
+	cache->misses = 0;
+	cache->evictions = 0;
+}
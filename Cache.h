@@ -0,0 +1,88 @@
+/**********************************************************************
+ *
+ * PROJECT:		Types library
+ * FILE:		Cache.h
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		A bounded LRU/LFU cache. Every entry is a single
+ *				allocation holding its hash chain link, its recency
+ *				links and a copy of its key.
+ *
+ *				(c) Tuomo Jauhiainen 2012
+ *
+ **********************************************************************/
+
+#pragma once
+#ifndef __MYLLY_CACHE_H
+#define __MYLLY_CACHE_H
+
+#include "stdtypes.h"
+#include "HashMap.h"
+
+typedef void ( *cache_evict_func_t )( const void* key, const void* data );
+
+typedef enum {
+	CACHE_LRU,						// Evict the least recently used entry
+	CACHE_LFU,						// Evict the least frequently used entry, the least recently used one of equals
+} cache_policy_t;
+
+typedef struct centry_s {
+	struct centry_s*	next;		// Next entry in the same bucket
+	struct centry_s*	newer;		// Next more recently used entry
+	struct centry_s*	older;		// Next less recently used entry
+	struct cfreq_s*		freq;		// Use count group of the entry, LFU only
+	uint32				hash;		// Full hash of the key
+	size_t				size;		// Size of the entry, counted against the byte capacity
+	const void*			key;		// Key assigned to this entry, stored after the entry if possible
+	const void*			data;		// Stored data
+} cacheentry_t;
+
+typedef struct {
+	cacheentry_t*		newest;		// The most recently used entry
+	cacheentry_t*		oldest;		// The least recently used entry, evicted first
+} cachelist_t;
+
+typedef struct cfreq_s {
+	struct cfreq_s*		next;		// Group with the next higher use count
+	struct cfreq_s*		prev;		// Group with the next lower use count
+	uint32				count;		// Use count of the entries in this group
+	cachelist_t			entries;	// The entries of this group in recency order
+} cachefreq_t;
+
+typedef struct {
+	cache_policy_t		policy;			// Eviction policy
+	cacheentry_t**		buckets;		// Bucket array
+	uint32				bucket_count;	// Number of buckets, a power of two
+	uint32				size;			// Number of entries stored
+	size_t				bytes;			// Total size of the entries stored
+	uint32				max_entries;	// Entry capacity, 0 for no limit
+	size_t				max_bytes;		// Byte capacity, 0 for no limit
+	cachelist_t			recent;			// Entries in recency order, LRU only
+	cachefreq_t*		rarest;			// Group with the lowest use count, LFU only
+	uint64				hits;			// Lookups which found their key
+	uint64				misses;			// Lookups which did not find their key
+	uint64				evictions;		// Entries evicted to stay within the capacity
+	hash_func_t			key_hash;		// Hash function
+	key_func_t			key_equals;		// Key comparison function
+	key_dup_func_t		key_dup;		// Function to duplicate a key
+	data_destruct_t		key_free;		// Function to free a duplicated key
+	key_size_func_t		key_size;		// Size of a key, used to copy the key into the entry
+	cache_evict_func_t	evict;			// Called for every entry dropped by the cache, NULL for none
+} cache_t;
+
+__BEGIN_DECLS
+
+MYLLY_API cache_t*			cache_create			( cache_policy_t policy, uint32 max_entries, size_t max_bytes, hashmap_key_type_t keys );
+MYLLY_API void				cache_destroy			( cache_t* cache );
+MYLLY_API void				cache_set_key_funcs		( cache_t* cache, const hashmap_key_funcs_t* funcs );
+MYLLY_API void				cache_set_evict_func	( cache_t* cache, cache_evict_func_t evict );
+
+MYLLY_API void*				cache_get				( cache_t* cache, const void* key );
+MYLLY_API void*				cache_peek				( cache_t* cache, const void* key );
+MYLLY_API void*				cache_put				( cache_t* cache, const void* key, const void* data, size_t size );
+MYLLY_API void*				cache_erase				( cache_t* cache, const void* key );
+MYLLY_API void				cache_clear				( cache_t* cache );
+MYLLY_API void				cache_reset_counters	( cache_t* cache );
+
+__END_DECLS
+
+#endif /* __MYLLY_CACHE_H */
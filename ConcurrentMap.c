@@ -0,0 +1,700 @@
+/**********************************************************************
+ *
+ * PROJECT:		Types library
+ * FILE:		ConcurrentMap.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		A thread safe hash map with wait-free readers. Writers
+ *				use striped locks, erased nodes and retired bucket
+ *				arrays are reclaimed with epoch based reclamation.
+ *
+ *				(c) Tuomo Jauhiainen 2012
+ *
+ **********************************************************************/
+
+#include "Types/ConcurrentMap.h"
+#include <malloc.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONCMAP_INITIAL_CAPACITY	(128)
+#define CONCMAP_MAX_LOAD_FACTOR		(0.75f)
+#define CONCMAP_MAX_READERS			(256)	// Number of reader slots, more readers share the overflow slot
+#define CONCMAP_OVERFLOW_READER		CONCMAP_MAX_READERS	// Index of the shared overflow slot
+#define CONCMAP_RECLAIM_THRESHOLD	(64)	// Retired objects before trying to reclaim them
+
+// Reader states. An active reader stores the epoch it entered in shifted left by one.
+#define CONCMAP_READER_FREE			(0)
+#define CONCMAP_READER_IDLE			(2)
+#define CONCMAP_READER_ACTIVE		(1)
+
+enum {
+	CONCMAP_RETIRE_ENTRY,		// An erased node: destroy the data, free the key and the node
+	CONCMAP_RETIRE_DATA,		// Data replaced by an insert
+	CONCMAP_RETIRE_TABLE,		// A bucket array replaced by a resize, the nodes were copied
+	CONCMAP_RETIRE_CLEARED,		// A bucket array replaced by a clear, including every entry
+};
+
+typedef struct {
+	volatile uint32			state;		// CONCMAP_READER_* or the entered epoch
+	uint8					padding[60];// Keep every reader on its own cache line
+} concreader_t;
+
+// Reader registry shared by every concurrent map. The last slot is shared by the
+// readers which found every other slot taken, it is protected by the overflow lock.
+static concreader_t			concmap_readers[CONCMAP_MAX_READERS + 1];
+static volatile uint32		concmap_epoch = 1;
+static mutex_t				concmap_overflow_lock;
+static uint32				concmap_overflow_count = 0;	// Readers inside the overflow slot
+
+// A thread local key whose destructor releases the slot of an exiting thread.
+#ifdef _WIN32
+static INIT_ONCE			concmap_once = INIT_ONCE_STATIC_INIT;
+static DWORD				concmap_exit_key;
+#else
+static pthread_once_t		concmap_once = PTHREAD_ONCE_INIT;
+static pthread_key_t		concmap_exit_key;
+#endif
+
+static MYLLY_THREAD_LOCAL int32		concmap_reader = -1;
+static MYLLY_THREAD_LOCAL uint32	concmap_depth = 0;
+
+/*
+ * __concmap_alloc - An allocator func with further error
+ * checking. Exits the app if allocating fails.
+ * @arg size: Size to be allocated in bytes
+ * @returns: A pointer to the allocated memory block
+ */
+static void* __concmap_alloc( size_t size )
+{
+	void* ptr;
+
+	ptr = malloc( size );
+
+	assert( ptr != NULL ); // If we're in debug mode trigger the assertion
+	if ( ptr ) return ptr;
+
+	exit( EXIT_FAILURE ); // Otherwise exit the application just in case
+}
+
+/*
+ * __concmap_free - A memory freeing func.
+ * @arg ptr: Memory block to be freed.
+ */
+static void __concmap_free( const void* ptr )
+{
+	free( (void*)ptr );
+}
+
+/*
+ * __concmap_release_reader - Free a reader slot. Called with the slot index plus
+ * one by the destructor of the thread local key when a thread exits.
+ * @arg value: Index of the slot plus one
+ */
+#ifdef _WIN32
+static VOID WINAPI __concmap_release_reader( PVOID value )
+#else
+static void __concmap_release_reader( void* value )
+#endif
+{
+	if ( value == NULL ) return;
+
+	atomic_store_u32( &concmap_readers[(size_t)value - 1].state, CONCMAP_READER_FREE );
+}
+
+/*
+ * __concmap_init_readers - Create the thread local key and the overflow lock. Run once.
+ */
+#ifdef _WIN32
+static BOOL CALLBACK __concmap_init_readers( PINIT_ONCE once, PVOID param, PVOID* context )
+{
+	UNREFERENCED_PARAMETER( once );
+	UNREFERENCED_PARAMETER( param );
+	UNREFERENCED_PARAMETER( context );
+
+	concmap_exit_key = FlsAlloc( __concmap_release_reader );
+	assert( concmap_exit_key != FLS_OUT_OF_INDEXES );
+
+	mutex_init( &concmap_overflow_lock );
+	return TRUE;
+}
+#else
+static void __concmap_init_readers( void )
+{
+	int error;
+
+	error = pthread_key_create( &concmap_exit_key, __concmap_release_reader );
+	assert( error == 0 );
+	(void)error;
+
+	mutex_init( &concmap_overflow_lock );
+}
+#endif
+
+/*
+ * __concmap_claim_reader - Claim a reader slot for the calling thread. The slot is
+ * released when the thread exits, or earlier by concmap_thread_exit.
+ * @returns: Index of the slot, CONCMAP_OVERFLOW_READER if every slot is taken
+ */
+static int32 __concmap_claim_reader( void )
+{
+	int32 i;
+
+#ifdef _WIN32
+	InitOnceExecuteOnce( &concmap_once, __concmap_init_readers, NULL, NULL );
+#else
+	pthread_once( &concmap_once, __concmap_init_readers );
+#endif
+
+	for ( i = 0; i < CONCMAP_MAX_READERS; i++ )
+	{
+		if ( atomic_load_u32( &concmap_readers[i].state ) == CONCMAP_READER_FREE &&
+			 atomic_cas_u32( &concmap_readers[i].state, CONCMAP_READER_FREE, CONCMAP_READER_IDLE ) )
+		{
+#ifdef _WIN32
+			FlsSetValue( concmap_exit_key, (PVOID)(size_t)( i + 1 ) );
+#else
+			pthread_setspecific( concmap_exit_key, (void*)(size_t)( i + 1 ) );
+#endif
+			return i;
+		}
+	}
+
+	return CONCMAP_OVERFLOW_READER;
+}
+
+/*
+ * concmap_read_begin - Enter a read side critical section. Nodes and data seen
+ * inside the section are not reclaimed before the section ends. Sections nest.
+ */
+void concmap_read_begin( void )
+{
+	uint32 epoch;
+
+	if ( concmap_depth++ ) return;
+
+	// Threads on the overflow slot look for a slot of their own again on every section.
+	if ( concmap_reader < 0 || concmap_reader == CONCMAP_OVERFLOW_READER )
+		concmap_reader = __concmap_claim_reader();
+
+	if ( concmap_reader == CONCMAP_OVERFLOW_READER )
+	{
+		// The shared slot keeps the epoch of its first reader until every reader has left it.
+		mutex_lock( &concmap_overflow_lock );
+
+		if ( concmap_overflow_count++ == 0 )
+		{
+			epoch = atomic_load_u32( &concmap_epoch );
+			atomic_store_u32( &concmap_readers[CONCMAP_OVERFLOW_READER].state, ( epoch << 1 ) | CONCMAP_READER_ACTIVE );
+		}
+
+		atomic_fence();
+		mutex_unlock( &concmap_overflow_lock );
+		return;
+	}
+
+	epoch = atomic_load_u32( &concmap_epoch );
+	atomic_store_u32( &concmap_readers[concmap_reader].state, ( epoch << 1 ) | CONCMAP_READER_ACTIVE );
+
+	// The announcement must be visible before any shared pointer is read.
+	atomic_fence();
+}
+
+/*
+ * concmap_read_end - Leave a read side critical section.
+ */
+void concmap_read_end( void )
+{
+	assert( concmap_depth > 0 );
+
+	if ( --concmap_depth ) return;
+
+	if ( concmap_reader == CONCMAP_OVERFLOW_READER )
+	{
+		mutex_lock( &concmap_overflow_lock );
+
+		if ( --concmap_overflow_count == 0 )
+			atomic_store_u32( &concmap_readers[CONCMAP_OVERFLOW_READER].state, CONCMAP_READER_IDLE );
+
+		mutex_unlock( &concmap_overflow_lock );
+		return;
+	}
+
+	atomic_store_u32( &concmap_readers[concmap_reader].state, CONCMAP_READER_IDLE );
+}
+
+/*
+ * concmap_thread_exit - Release the reader slot of the calling thread before it exits.
+ * Slots are released automatically when a thread exits, this only frees the slot early.
+ */
+void concmap_thread_exit( void )
+{
+	assert( concmap_depth == 0 );
+
+	if ( concmap_reader < 0 ) return;
+
+	if ( concmap_reader != CONCMAP_OVERFLOW_READER )
+	{
+#ifdef _WIN32
+		FlsSetValue( concmap_exit_key, NULL );
+#else
+		pthread_setspecific( concmap_exit_key, NULL );
+#endif
+		atomic_store_u32( &concmap_readers[concmap_reader].state, CONCMAP_READER_FREE );
+	}
+
+	concmap_reader = -1;
+}
+
+/*
+ * __concmap_try_advance - Advance the global epoch if every active reader has
+ * entered during the current one.
+ * @returns: The global epoch after the attempt
+ */
+static uint32 __concmap_try_advance( void )
+{
+	uint32 i, epoch, state;
+
+	epoch = atomic_load_u32( &concmap_epoch );
+
+	for ( i = 0; i <= CONCMAP_MAX_READERS; i++ )
+	{
+		state = atomic_load_u32( &concmap_readers[i].state );
+
+		if ( ( state & CONCMAP_READER_ACTIVE ) && ( state >> 1 ) != ( epoch & 0x7FFFFFFF ) )
+			return epoch;
+	}
+
+	atomic_cas_u32( &concmap_epoch, epoch, epoch + 1 );
+
+	return atomic_load_u32( &concmap_epoch );
+}
+
+/*
+ * __concmap_table_create - Allocate an empty bucket array.
+ * @arg buckets: Number of buckets, a power of two
+ * @returns: The new bucket array
+ */
+static conctable_t* __concmap_table_create( uint32 buckets )
+{
+	conctable_t* table;
+
+	table = __concmap_alloc( sizeof(*table) + sizeof(concnode_t*) * ( buckets - 1 ) );
+	table->bucket_count = buckets;
+
+	memset( (void*)table->buckets, 0, sizeof(concnode_t*) * buckets );
+
+	return table;
+}
+
+/*
+ * __concmap_release - Free a retired object. No reader can see it anymore.
+ * @arg map: The map the object was retired from
+ * @arg kind: The kind of the object, CONCMAP_RETIRE_*
+ * @arg ptr: The object
+ */
+static void __concmap_release( concmap_t* map, uint32 kind, void* ptr )
+{
+	conctable_t* table;
+	concnode_t *node, *next;
+	uint32 i;
+
+	switch ( kind )
+	{
+	case CONCMAP_RETIRE_ENTRY:
+		node = (concnode_t*)ptr;
+
+		if ( map->data_destroy )
+			map->data_destroy( node->data );
+
+		map->keys.key_free( node->key );
+		__concmap_free( node );
+		break;
+
+	case CONCMAP_RETIRE_DATA:
+		map->data_destroy( ptr );
+		break;
+
+	case CONCMAP_RETIRE_TABLE:
+	case CONCMAP_RETIRE_CLEARED:
+		table = (conctable_t*)ptr;
+
+		for ( i = 0; i < table->bucket_count; i++ )
+		{
+			for ( node = table->buckets[i]; node; node = next )
+			{
+				next = node->next;
+
+				// A resized table shares its keys and data with the copied nodes.
+				if ( kind == CONCMAP_RETIRE_CLEARED )
+					__concmap_release( map, CONCMAP_RETIRE_ENTRY, node );
+				else
+					__concmap_free( node );
+			}
+		}
+
+		__concmap_free( table );
+		break;
+	}
+}
+
+/*
+ * __concmap_reclaim - Free every retired object no reader can see anymore.
+ * Must be called with the retire lock held.
+ * @arg map: Concurrent map
+ * @arg all: Free everything regardless of the readers (the map is being destroyed)
+ */
+static void __concmap_reclaim( concmap_t* map, bool all )
+{
+	concretire_t **link, *retired;
+	uint32 epoch;
+
+	epoch = __concmap_try_advance();
+
+	for ( link = &map->retired; *link; )
+	{
+		retired = *link;
+
+		// Two epoch advances guarantee every reader that saw the object has left.
+		if ( !all && epoch - retired->epoch < 2 )
+		{
+			link = &retired->next;
+			continue;
+		}
+
+		*link = retired->next;
+		map->retired_count--;
+
+		__concmap_release( map, retired->kind, retired->ptr );
+		__concmap_free( retired );
+	}
+}
+
+/*
+ * __concmap_retire - Queue an object unlinked from the map to be freed once
+ * every reader that might have seen it has left its read section.
+ * @arg map: Concurrent map
+ * @arg kind: The kind of the object, CONCMAP_RETIRE_*
+ * @arg ptr: The object
+ */
+static void __concmap_retire( concmap_t* map, uint32 kind, void* ptr )
+{
+	concretire_t* retired;
+
+	retired = __concmap_alloc( sizeof(*retired) );
+	retired->kind = kind;
+	retired->ptr = ptr;
+
+	// The unlink must be globally visible before the epoch is sampled.
+	atomic_fence();
+	retired->epoch = atomic_load_u32( &concmap_epoch );
+
+	mutex_lock( &map->retire_lock );
+
+	retired->next = map->retired;
+	map->retired = retired;
+
+	if ( ++map->retired_count >= CONCMAP_RECLAIM_THRESHOLD )
+		__concmap_reclaim( map, false );
+
+	mutex_unlock( &map->retire_lock );
+}
+
+/*
+ * __concmap_lock_all - Lock every writer stripe, in order.
+ */
+static void __concmap_lock_all( concmap_t* map )
+{
+	uint32 i;
+
+	for ( i = 0; i < CONCMAP_STRIPES; i++ )
+		mutex_lock( &map->stripes[i] );
+}
+
+/*
+ * __concmap_unlock_all - Unlock every writer stripe.
+ */
+static void __concmap_unlock_all( concmap_t* map )
+{
+	uint32 i;
+
+	for ( i = CONCMAP_STRIPES; i > 0; i-- )
+		mutex_unlock( &map->stripes[i-1] );
+}
+
+/*
+ * concmap_create - Create a concurrent hash map.
+ * @arg size: Initial number of buckets, 0 for the default
+ * @arg keys: Type of the keys, selects the key functions like for hashmap_t
+ * @returns: The created map
+ */
+concmap_t* concmap_create( uint32 size, hashmap_key_type_t keys )
+{
+	concmap_t* map;
+	uint32 i, buckets;
+
+	map = __concmap_alloc( sizeof(*map) );
+
+	// Every bucket must belong to a single stripe.
+	for ( buckets = CONCMAP_STRIPES; buckets < size || buckets < CONCMAP_INITIAL_CAPACITY; )
+		buckets <<= 1;
+
+	map->table = __concmap_table_create( buckets );
+	map->size = 0;
+	map->max_load_factor = CONCMAP_MAX_LOAD_FACTOR;
+	map->retired = NULL;
+	map->retired_count = 0;
+	map->keys = *hashmap_key_funcs( keys );
+	map->data_destroy = NULL;
+
+	for ( i = 0; i < CONCMAP_STRIPES; i++ )
+		mutex_init( &map->stripes[i] );
+
+	mutex_init( &map->retire_lock );
+
+	return map;
+}
+
+/*
+ * concmap_destroy - Destroy a concurrent map. No other thread may use the map anymore.
+ * @arg map: The map to be destroyed
+ */
+void concmap_destroy( concmap_t* map )
+{
+	uint32 i;
+
+	assert( map != NULL );
+
+	__concmap_release( map, CONCMAP_RETIRE_CLEARED, map->table );
+	__concmap_reclaim( map, true );
+
+	for ( i = 0; i < CONCMAP_STRIPES; i++ )
+		mutex_destroy( &map->stripes[i] );
+
+	mutex_destroy( &map->retire_lock );
+
+	__concmap_free( map );
+}
+
+/*
+ * __concmap_grow - Double the bucket count. The nodes are copied into the new
+ * bucket array so readers walking the old chains never end up on a wrong chain.
+ * @arg map: Concurrent map
+ * @arg buckets: The bucket count which was found to be too small
+ */
+static void __concmap_grow( concmap_t* map, uint32 buckets )
+{
+	conctable_t *table, *old;
+	concnode_t *node, *copy;
+	uint32 i, bucket;
+
+	__concmap_lock_all( map );
+
+	old = map->table;
+
+	// Another writer may have grown the map while we were waiting.
+	if ( old->bucket_count != buckets )
+	{
+		__concmap_unlock_all( map );
+		return;
+	}
+
+	table = __concmap_table_create( buckets * 2 );
+
+	for ( i = 0; i < old->bucket_count; i++ )
+	{
+		for ( node = old->buckets[i]; node; node = node->next )
+		{
+			bucket = node->hash & ( table->bucket_count - 1 );
+
+			copy = __concmap_alloc( sizeof(*copy) );
+			copy->key = node->key;
+			copy->data = node->data;
+			copy->hash = node->hash;
+			copy->next = table->buckets[bucket];
+
+			table->buckets[bucket] = copy;
+		}
+	}
+
+	atomic_store_ptr( (void* volatile*)&map->table, table );
+
+	__concmap_unlock_all( map );
+
+	__concmap_retire( map, CONCMAP_RETIRE_TABLE, old );
+}
+
+/*
+ * concmap_insert - Insert a new key-data pair to the map.
+ * If a key exists already, the previous data will be overwritten.
+ * @arg map: Concurrent map
+ * @arg key: Pointer to the key value
+ * @arg data: The data to be stored
+ * @returns: Previous data assigned to this key, NULL if nothing was stored or a destructor
+ * will be called. Readers may still be using the returned data.
+ */
+void* concmap_insert( concmap_t* map, const void* key, void* data )
+{
+	mutex_t* stripe;
+	conctable_t* table;
+	concnode_t *node, * volatile* bucket;
+	uint32 hash, size, buckets;
+	void* old;
+
+	assert( map != NULL );
+
+	hash = map->keys.key_hash( key );
+	stripe = &map->stripes[hash & ( CONCMAP_STRIPES - 1 )];
+
+	mutex_lock( stripe );
+
+	table = map->table;
+	bucket = &table->buckets[hash & ( table->bucket_count - 1 )];
+
+	for ( node = *bucket; node; node = node->next )
+	{
+		if ( node->hash == hash && map->keys.key_equals( key, node->key ) )
+		{
+			old = node->data;
+			atomic_store_ptr( &node->data, data );
+
+			mutex_unlock( stripe );
+
+			if ( map->data_destroy && old )
+			{
+				__concmap_retire( map, CONCMAP_RETIRE_DATA, old );
+				return NULL;
+			}
+
+			return old;
+		}
+	}
+
+	node = __concmap_alloc( sizeof(*node) );
+	node->key = map->keys.key_dup( key );
+	node->data = data;
+	node->hash = hash;
+	node->next = *bucket;
+
+	// Publish the fully initialized node to the readers.
+	atomic_store_ptr( (void* volatile*)bucket, node );
+
+	buckets = table->bucket_count;
+	size = atomic_add_u32( &map->size, 1 );
+
+	mutex_unlock( stripe );
+
+	if ( size > map->max_load_factor * buckets )
+		__concmap_grow( map, buckets );
+
+	return NULL;
+}
+
+/*
+ * concmap_erase - Remove a key-data pair from the map.
+ * @arg map: Concurrent map
+ * @arg key: Pointer to the key value
+ * @returns: Removed data, NULL if nothing was stored or a destructor will be called.
+ * Readers may still be using the returned data.
+ */
+void* concmap_erase( concmap_t* map, const void* key )
+{
+	mutex_t* stripe;
+	conctable_t* table;
+	concnode_t *node, * volatile* link;
+	uint32 hash;
+	void* data;
+
+	assert( map != NULL );
+
+	hash = map->keys.key_hash( key );
+	stripe = &map->stripes[hash & ( CONCMAP_STRIPES - 1 )];
+
+	mutex_lock( stripe );
+
+	table = map->table;
+
+	for ( link = &table->buckets[hash & ( table->bucket_count - 1 )]; *link; link = &(*link)->next )
+	{
+		node = *link;
+
+		if ( node->hash == hash && map->keys.key_equals( key, node->key ) )
+		{
+			// Readers standing on the node can still follow its next pointer.
+			atomic_store_ptr( (void* volatile*)link, node->next );
+			atomic_add_u32( &map->size, -1 );
+
+			mutex_unlock( stripe );
+
+			data = node->data;
+
+			__concmap_retire( map, CONCMAP_RETIRE_ENTRY, node );
+
+			return map->data_destroy ? NULL : data;
+		}
+	}
+
+	mutex_unlock( stripe );
+
+	return NULL;
+}
+
+/*
+ * concmap_find - Find a data pointer matching the given key. Wait-free while the
+ * calling thread has a reader slot of its own, see CONCMAP_MAX_READERS.
+ * @arg map: Concurrent map
+ * @arg key: The key
+ * @returns: Found data, or NULL if no data was found. To use the data while
+ * other threads may erase it, wrap the call and the use in concmap_read_begin/end.
+ */
+void* concmap_find( concmap_t* map, const void* key )
+{
+	conctable_t* table;
+	concnode_t* node;
+	uint32 hash;
+	void* data = NULL;
+
+	assert( map != NULL );
+
+	hash = map->keys.key_hash( key );
+
+	concmap_read_begin();
+
+	table = atomic_load_ptr( (void* volatile*)&map->table );
+	node = atomic_load_ptr( (void* volatile*)&table->buckets[hash & ( table->bucket_count - 1 )] );
+
+	for ( ; node; node = atomic_load_ptr( (void* volatile*)&node->next ) )
+	{
+		if ( node->hash == hash && map->keys.key_equals( key, node->key ) )
+		{
+			data = atomic_load_ptr( &node->data );
+			break;
+		}
+	}
+
+	concmap_read_end();
+
+	return data;
+}
+
+/*
+ * concmap_clear - Remove every entry from the map.
+ * @arg map: Concurrent map
+ */
+void concmap_clear( concmap_t* map )
+{
+	conctable_t* old;
+
+	assert( map != NULL );
+
+	__concmap_lock_all( map );
+
+	old = map->table;
+
+	atomic_store_ptr( (void* volatile*)&map->table, __concmap_table_create( old->bucket_count ) );
+	atomic_store_u32( &map->size, 0 );
+
+	__concmap_unlock_all( map );
+
+	__concmap_retire( map, CONCMAP_RETIRE_CLEARED, old );
+}
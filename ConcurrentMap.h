@@ -0,0 +1,71 @@
+/**********************************************************************
+ *
+ * PROJECT:		Types library
+ * FILE:		ConcurrentMap.h
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		A thread safe hash map with wait-free readers. Writers
+ *				use striped locks, erased nodes and retired bucket
+ *				arrays are reclaimed with epoch based reclamation.
+ *
+ *				(c) Tuomo Jauhiainen 2012
+ *
+ **********************************************************************/
+
+#pragma once
+#ifndef __MYLLY_CONCURRENTMAP_H
+#define __MYLLY_CONCURRENTMAP_H
+
+#include "stdtypes.h"
+#include "HashMap.h"
+#include "Thread.h"
+
+#define CONCMAP_STRIPES		(64)	// Number of writer locks, a power of two
+
+typedef struct cnode_s {
+	const void*				key;		// Key assigned to this node
+	void* volatile			data;		// Stored data
+	uint32					hash;		// Full hash of the key
+	struct cnode_s* volatile next;		// Next node in the bucket
+} concnode_t;
+
+typedef struct {
+	uint32					bucket_count;	// Number of buckets, a power of two
+	concnode_t* volatile	buckets[1];		// The buckets, allocated to bucket_count
+} conctable_t;
+
+typedef struct cretire_s {
+	struct cretire_s*		next;		// Next retired object
+	uint32					epoch;		// Global epoch when the object was retired
+	uint32					kind;		// What kind of an object this is
+	void*					ptr;		// The retired object
+} concretire_t;
+
+typedef struct {
+	conctable_t* volatile	table;		// Current bucket array
+	volatile uint32			size;		// Number of elements stored
+	float					max_load_factor; // Maximum load factor
+	mutex_t					stripes[CONCMAP_STRIPES]; // Writer locks, selected by the low bits of the hash
+	mutex_t					retire_lock;// Protects the retired list
+	concretire_t*			retired;	// Objects waiting for all readers to leave
+	uint32					retired_count; // Number of objects in the retired list
+	hashmap_key_funcs_t		keys;		// Key functions, same as hashmap_t uses
+	data_destruct_t			data_destroy; // A custom destructor for the saved data
+} concmap_t;
+
+__BEGIN_DECLS
+
+MYLLY_API concmap_t*		concmap_create			( uint32 size, hashmap_key_type_t keys );
+MYLLY_API void				concmap_destroy			( concmap_t* map );
+
+MYLLY_API void*				concmap_insert			( concmap_t* map, const void* key, void* data );
+MYLLY_API void*				concmap_erase			( concmap_t* map, const void* key );
+MYLLY_API void*				concmap_find			( concmap_t* map, const void* key );
+MYLLY_API void				concmap_clear			( concmap_t* map );
+
+MYLLY_API void				concmap_read_begin		( void );
+MYLLY_API void				concmap_read_end		( void );
+MYLLY_API void				concmap_thread_exit		( void );
+
+__END_DECLS
+
+#endif /* __MYLLY_CONCURRENTMAP_H */
@@ -0,0 +1,696 @@
+/**********************************************************************
+ *
+ * PROJECT:		Types library
+ * FILE:		Hamt.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		A persistent hash array mapped trie. Snapshots share
+ *				their nodes with the map and take O(1) time, updates
+ *				copy only the path to the changed entry. A map and its
+ *				snapshots may be used from different threads, a single
+ *				hamt_t may not.
+ *
+ *				(c) Tuomo Jauhiainen 2012
+ *
+ **********************************************************************/
+
+#include "Types/Hamt.h"
+#include "Types/Thread.h"
+#include <malloc.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HAMT_HASH_BITS		(32)			// Bits in a key hash, deeper nodes hold colliding keys
+#define HAMT_NONE			( (uint32)-1 )	// No slot
+
+// A key being inserted or erased.
+typedef struct {
+	uint32			hash;			// Full hash of the key
+	const void*		key;			// The key as passed by the caller
+	const void*		data;			// Data to be stored, inserts only
+} hamtkey_t;
+
+/*
+ * __hamt_alloc - An allocator func with further error
+ * checking. Exits the app if allocating fails.
+ * @arg size: Size to be allocated in bytes
+ * @returns: A pointer to the allocated memory block
+ */
+static void* __hamt_alloc( size_t size )
+{
+	void* ptr;
+
+	ptr = malloc( size );
+
+	assert( ptr != NULL ); // If we're in debug mode trigger the assertion
+	if ( ptr ) return ptr;
+
+	exit( EXIT_FAILURE ); // Otherwise exit the application just in case
+}
+
+/*
+ * __hamt_free - A memory freeing func.
+ * @arg ptr: Memory block to be freed.
+ */
+static void __hamt_free( const void* ptr )
+{
+	free( (void*)ptr );
+}
+
+/*
+ * __hamt_popcount - Count the set bits of a slot mask.
+ * @arg mask: The mask
+ * @returns: Number of bits set
+ */
+static MYLLY_INLINE uint32 __hamt_popcount( uint32 mask )
+{
+#if defined(__GNUC__)
+	return (uint32)__builtin_popcount( mask );
+#else
+	mask = mask - ( ( mask >> 1 ) & 0x55555555 );
+	mask = ( mask & 0x33333333 ) + ( ( mask >> 2 ) & 0x33333333 );
+
+	return ( ( ( mask + ( mask >> 4 ) ) & 0x0F0F0F0F ) * 0x01010101 ) >> 24;
+#endif
+}
+
+/*
+ * __hamt_bit - Get the slot bit of a hash on a level of the trie.
+ * @arg hash: Full hash of the key
+ * @arg shift: Hash bits consumed by the levels above
+ * @returns: The slot bit
+ */
+static MYLLY_INLINE uint32 __hamt_bit( uint32 hash, uint32 shift )
+{
+	return 1u << ( ( hash >> shift ) & ( HAMT_FANOUT - 1 ) );
+}
+
+/*
+ * __hamt_matches - Check whether a leaf holds a key.
+ * @arg map: The map
+ * @arg leaf: The leaf
+ * @arg k: The key
+ * @returns: true if the leaf holds the key
+ */
+static MYLLY_INLINE bool __hamt_matches( hamt_t* map, const hamtleaf_t* leaf, const hamtkey_t* k )
+{
+	return leaf->hash == k->hash && map->key_equals( leaf->key, k->key );
+}
+
+/*
+ * __hamt_retain - Add a reference to a leaf or a node. Both start with their reference count.
+ * @arg obj: The leaf or the node
+ */
+static MYLLY_INLINE void __hamt_retain( void* obj )
+{
+	atomic_add_u32( (volatile uint32*)obj, 1 );
+}
+
+/*
+ * __hamt_owned - Check whether a leaf or a node is referenced only once. Such an object
+ * can be changed in place when its referrer is owned by the map being updated as well.
+ * @arg obj: The leaf or the node
+ * @returns: true if there is a single reference to the object
+ */
+static MYLLY_INLINE bool __hamt_owned( void* obj )
+{
+	return atomic_load_u32( (volatile uint32*)obj ) == 1;
+}
+
+/*
+ * __hamt_leaf_create - Create a leaf for a key-data pair. The key is duplicated.
+ * @arg map: The map
+ * @arg k: The key and the data
+ * @returns: The leaf, with a single reference
+ */
+static hamtleaf_t* __hamt_leaf_create( hamt_t* map, const hamtkey_t* k )
+{
+	hamtleaf_t* leaf;
+
+	leaf = __hamt_alloc( sizeof(*leaf) );
+
+	leaf->refs = 1;
+	leaf->hash = k->hash;
+	leaf->key = map->key_dup( k->key );
+	leaf->data = k->data;
+
+	return leaf;
+}
+
+/*
+ * __hamt_leaf_release - Drop a reference to a leaf, destroying it along with
+ * its key and data once nothing references it.
+ * @arg map: The map
+ * @arg leaf: The leaf
+ */
+static void __hamt_leaf_release( hamt_t* map, hamtleaf_t* leaf )
+{
+	if ( atomic_add_u32( &leaf->refs, -1 ) != 0 ) return;
+
+	map->key_free( leaf->key );
+
+	if ( map->data_destroy )
+		map->data_destroy( leaf->data );
+
+	__hamt_free( leaf );
+}
+
+/*
+ * __hamt_node_create - Allocate a node.
+ * @arg count: Number of slots
+ * @arg datamap: Slots holding a leaf
+ * @arg nodemap: Slots holding a child node
+ * @returns: The node, with a single reference
+ */
+static hamtnode_t* __hamt_node_create( uint32 count, uint32 datamap, uint32 nodemap )
+{
+	hamtnode_t* node;
+
+	node = __hamt_alloc( sizeof(*node) + ( count > 1 ? count - 1 : 0 ) * sizeof(void*) );
+
+	node->refs = 1;
+	node->datamap = datamap;
+	node->nodemap = nodemap;
+	node->count = count;
+
+	return node;
+}
+
+/*
+ * __hamt_node_release - Drop a reference to a node, destroying it along with
+ * its leaves and child nodes once nothing references it.
+ * @arg map: The map
+ * @arg node: The node
+ */
+static void __hamt_node_release( hamt_t* map, hamtnode_t* node )
+{
+	uint32 i, leaves;
+
+	if ( atomic_add_u32( &node->refs, -1 ) != 0 ) return;
+
+	leaves = node->count - __hamt_popcount( node->nodemap );
+
+	for ( i = 0; i < leaves; i++ )
+		__hamt_leaf_release( map, node->slots[i] );
+
+	for ( ; i < node->count; i++ )
+		__hamt_node_release( map, node->slots[i] );
+
+	__hamt_free( node );
+}
+
+/*
+ * __hamt_node_edit - Remove a slot from a node and/or insert a new one. An owned node
+ * is changed in place when the number of slots stays the same, otherwise it is moved
+ * to a new allocation. A shared node is copied and the copy gets its own references
+ * to the slots it keeps. The reference of an owned node to the removed slot is
+ * dropped without releasing the slot, that is left to the caller.
+ * @arg node: The node
+ * @arg owned: The node is owned by the map being updated
+ * @arg remove: Slot to be removed, HAMT_NONE for none
+ * @arg insert: Index of the inserted slot in the edited node, HAMT_NONE for none
+ * @arg ptr: The leaf or the child node to be inserted
+ * @arg datamap: Slots holding a leaf after the edit
+ * @arg nodemap: Slots holding a child node after the edit
+ * @returns: The edited node
+ */
+static hamtnode_t* __hamt_node_edit( hamtnode_t* node, bool owned, uint32 remove, uint32 insert, void* ptr, uint32 datamap, uint32 nodemap )
+{
+	hamtnode_t* edit;
+	uint32 i, j, count;
+
+	if ( owned && remove == insert )
+	{
+		node->slots[insert] = ptr;
+		node->datamap = datamap;
+		node->nodemap = nodemap;
+
+		return node;
+	}
+
+	count = node->count - ( remove != HAMT_NONE ) + ( insert != HAMT_NONE );
+	edit = __hamt_node_create( count, datamap, nodemap );
+
+	for ( i = 0, j = 0; i < node->count; i++ )
+	{
+		if ( i == remove ) continue;
+		if ( j == insert ) j++;
+
+		edit->slots[j++] = node->slots[i];
+
+		if ( !owned )
+			__hamt_retain( node->slots[i] );
+	}
+
+	if ( insert != HAMT_NONE )
+		edit->slots[insert] = ptr;
+
+	// The slots of an owned node moved to the new one along with their references.
+	if ( owned )
+		__hamt_free( node );
+
+	return edit;
+}
+
+/*
+ * __hamt_merge - Create a subtrie for two leaves that ended up in the same slot.
+ * @arg leaf1: First leaf, the subtrie takes over a reference to it
+ * @arg leaf2: Second leaf, the subtrie takes over a reference to it
+ * @arg shift: Hash bits consumed by the levels above the subtrie
+ * @returns: Root node of the subtrie
+ */
+static hamtnode_t* __hamt_merge( hamtleaf_t* leaf1, hamtleaf_t* leaf2, uint32 shift )
+{
+	hamtnode_t* node;
+	uint32 bit1, bit2;
+
+	// Keys with the same full hash are kept in a collision node.
+	if ( shift >= HAMT_HASH_BITS )
+	{
+		node = __hamt_node_create( 2, 0, 0 );
+		node->slots[0] = leaf1;
+		node->slots[1] = leaf2;
+
+		return node;
+	}
+
+	bit1 = __hamt_bit( leaf1->hash, shift );
+	bit2 = __hamt_bit( leaf2->hash, shift );
+
+	if ( bit1 == bit2 )
+	{
+		node = __hamt_node_create( 1, 0, bit1 );
+		node->slots[0] = __hamt_merge( leaf1, leaf2, shift + HAMT_BITS );
+
+		return node;
+	}
+
+	node = __hamt_node_create( 2, bit1 | bit2, 0 );
+	node->slots[bit1 < bit2 ? 0 : 1] = leaf1;
+	node->slots[bit1 < bit2 ? 1 : 0] = leaf2;
+
+	return node;
+}
+
+/*
+ * __hamt_replace - Replace the data of a leaf. A leaf only the map being updated
+ * can reach is changed in place, otherwise a new leaf takes its slot.
+ * @arg map: The map
+ * @arg node: Node holding the leaf
+ * @arg owned: The node is owned by the map being updated
+ * @arg slot: Slot of the leaf
+ * @arg k: The key and the new data
+ * @arg old: Receives the previous data
+ * @returns: The edited node
+ */
+static hamtnode_t* __hamt_replace( hamt_t* map, hamtnode_t* node, bool owned, uint32 slot, const hamtkey_t* k, const void** old )
+{
+	hamtleaf_t* leaf;
+
+	leaf = node->slots[slot];
+	*old = leaf->data;
+
+	if ( owned && __hamt_owned( leaf ) )
+	{
+		leaf->data = k->data;
+
+		if ( map->data_destroy )
+			map->data_destroy( *old );
+
+		return node;
+	}
+
+	node = __hamt_node_edit( node, owned, slot, slot, __hamt_leaf_create( map, k ), node->datamap, node->nodemap );
+
+	if ( owned )
+		__hamt_leaf_release( map, leaf );
+
+	return node;
+}
+
+/*
+ * __hamt_insert - A recursive subroutine to insert a key-data pair into a subtrie.
+ * @arg map: The map
+ * @arg node: Root node of the subtrie
+ * @arg owned: The node is owned by the map being updated and can be changed in place
+ * @arg shift: Hash bits consumed by the levels above the node
+ * @arg k: The key and the data
+ * @arg old: Receives the previous data if the key existed
+ * @arg replaced: Set to true if the key existed
+ * @returns: The updated node, owned by the map
+ */
+static hamtnode_t* __hamt_insert( hamt_t* map, hamtnode_t* node, bool owned, uint32 shift, const hamtkey_t* k, const void** old, bool* replaced )
+{
+	hamtnode_t *child, *edit;
+	uint32 bit, slot, leaves;
+	bool child_owned;
+
+	if ( shift >= HAMT_HASH_BITS )
+	{
+		for ( slot = 0; slot < node->count; slot++ )
+		{
+			if ( __hamt_matches( map, node->slots[slot], k ) )
+			{
+				*replaced = true;
+				return __hamt_replace( map, node, owned, slot, k, old );
+			}
+		}
+
+		return __hamt_node_edit( node, owned, HAMT_NONE, node->count, __hamt_leaf_create( map, k ), 0, 0 );
+	}
+
+	bit = __hamt_bit( k->hash, shift );
+	leaves = __hamt_popcount( node->datamap );
+
+	if ( node->datamap & bit )
+	{
+		slot = __hamt_popcount( node->datamap & ( bit - 1 ) );
+
+		if ( __hamt_matches( map, node->slots[slot], k ) )
+		{
+			*replaced = true;
+			return __hamt_replace( map, node, owned, slot, k, old );
+		}
+
+		// Two keys share the slot, push both of them down a level.
+		if ( !owned )
+			__hamt_retain( node->slots[slot] );
+
+		child = __hamt_merge( node->slots[slot], __hamt_leaf_create( map, k ), shift + HAMT_BITS );
+
+		return __hamt_node_edit( node, owned, slot, leaves - 1 + __hamt_popcount( node->nodemap & ( bit - 1 ) ), child,
+								 node->datamap & ~bit, node->nodemap | bit );
+	}
+
+	if ( node->nodemap & bit )
+	{
+		slot = leaves + __hamt_popcount( node->nodemap & ( bit - 1 ) );
+		child = node->slots[slot];
+		child_owned = owned && __hamt_owned( child );
+
+		edit = __hamt_insert( map, child, child_owned, shift + HAMT_BITS, k, old, replaced );
+
+		// An owned node stops referencing the shared child it replaced with a copy.
+		if ( owned && !child_owned )
+			__hamt_node_release( map, child );
+
+		return __hamt_node_edit( node, owned, slot, slot, edit, node->datamap, node->nodemap );
+	}
+
+	slot = __hamt_popcount( node->datamap & ( bit - 1 ) );
+
+	return __hamt_node_edit( node, owned, HAMT_NONE, slot, __hamt_leaf_create( map, k ), node->datamap | bit, node->nodemap );
+}
+
+/*
+ * __hamt_erase - A recursive subroutine to remove a key from a subtrie.
+ * @arg map: The map
+ * @arg node: Root node of the subtrie
+ * @arg owned: The node is owned by the map being updated and can be changed in place
+ * @arg shift: Hash bits consumed by the levels above the node
+ * @arg k: The key
+ * @arg data: Receives the removed data
+ * @arg found: Set to true if the key was found
+ * @returns: The updated node, owned by the map. The node itself if the key wasn't found.
+ */
+static hamtnode_t* __hamt_erase( hamt_t* map, hamtnode_t* node, bool owned, uint32 shift, const hamtkey_t* k, const void** data, bool* found )
+{
+	hamtnode_t *child, *edit;
+	hamtleaf_t* leaf;
+	uint32 bit, slot;
+	bool child_owned;
+
+	if ( shift >= HAMT_HASH_BITS )
+	{
+		for ( slot = 0; slot < node->count; slot++ )
+		{
+			if ( __hamt_matches( map, node->slots[slot], k ) ) break;
+		}
+
+		if ( slot == node->count ) return node;
+
+		bit = 0;
+	}
+	else
+	{
+		bit = __hamt_bit( k->hash, shift );
+
+		if ( node->nodemap & bit )
+		{
+			slot = __hamt_popcount( node->datamap ) + __hamt_popcount( node->nodemap & ( bit - 1 ) );
+			child = node->slots[slot];
+			child_owned = owned && __hamt_owned( child );
+
+			edit = __hamt_erase( map, child, child_owned, shift + HAMT_BITS, k, data, found );
+			if ( !*found ) return node;
+
+			// A child left with a single leaf is replaced by the leaf, so every
+			// key is stored as high up in the trie as possible.
+			if ( edit->nodemap == 0 && edit->count == 1 )
+			{
+				leaf = edit->slots[0];
+
+				__hamt_retain( leaf );
+				__hamt_node_release( map, edit );
+
+				edit = __hamt_node_edit( node, owned, slot, __hamt_popcount( node->datamap & ( bit - 1 ) ), leaf,
+										 node->datamap | bit, node->nodemap & ~bit );
+			}
+			else
+			{
+				edit = __hamt_node_edit( node, owned, slot, slot, edit, node->datamap, node->nodemap );
+			}
+
+			if ( owned && !child_owned )
+				__hamt_node_release( map, child );
+
+			return edit;
+		}
+
+		if ( !( node->datamap & bit ) ) return node;
+
+		slot = __hamt_popcount( node->datamap & ( bit - 1 ) );
+
+		if ( !__hamt_matches( map, node->slots[slot], k ) ) return node;
+	}
+
+	leaf = node->slots[slot];
+
+	*found = true;
+	*data = leaf->data;
+
+	edit = __hamt_node_edit( node, owned, slot, HAMT_NONE, NULL, node->datamap & ~bit, node->nodemap );
+
+	if ( owned )
+		__hamt_leaf_release( map, leaf );
+
+	return edit;
+}
+
+/*
+ * hamt_create - Create an empty persistent map.
+ * @arg keys: Type of the keys, selects the hash and comparison functions like for a hashmap_t
+ * @returns: The created map
+ */
+hamt_t* hamt_create( hashmap_key_type_t keys )
+{
+	hamt_t* map;
+
+	map = __hamt_alloc( sizeof(*map) );
+
+	map->root = __hamt_node_create( 0, 0, 0 );
+	map->size = 0;
+	map->data_destroy = NULL;
+
+	hamt_set_key_funcs( map, hashmap_key_funcs( keys ) );
+
+	return map;
+}
+
+/*
+ * hamt_destroy - Destroy a map or a snapshot. The nodes shared with other snapshots
+ * are kept until the last one of them is destroyed.
+ * @arg map: The map to be destroyed
+ */
+void hamt_destroy( hamt_t* map )
+{
+	assert( map != NULL );
+
+	__hamt_node_release( map, map->root );
+	__hamt_free( map );
+}
+
+/*
+ * hamt_set_key_funcs - Set custom key functions. Only key_hash, key_equals, key_dup
+ * and key_free are used, the keys are always duplicated into the leaves.
+ * @arg map: An empty map
+ * @arg funcs: The key functions
+ */
+void hamt_set_key_funcs( hamt_t* map, const hashmap_key_funcs_t* funcs )
+{
+	assert( map != NULL );
+	assert( funcs != NULL );
+	assert( map->size == 0 ); // Existing keys would be freed with the wrong functions
+
+	map->key_hash = funcs->key_hash;
+	map->key_equals = funcs->key_equals;
+	map->key_dup = funcs->key_dup;
+	map->key_free = funcs->key_free;
+}
+
+/*
+ * hamt_snapshot - Take a snapshot of a map in O(1) time. The snapshot shares every
+ * node with the map, the next update of either one copies the nodes it changes.
+ * A snapshot is a map of its own, it can be handed to another thread, read and
+ * updated there, and has to be released with hamt_destroy.
+ * @arg map: The map
+ * @returns: The snapshot
+ */
+hamt_t* hamt_snapshot( hamt_t* map )
+{
+	hamt_t* snapshot;
+
+	assert( map != NULL );
+
+	snapshot = __hamt_alloc( sizeof(*snapshot) );
+	*snapshot = *map;
+
+	__hamt_retain( map->root );
+
+	return snapshot;
+}
+
+/*
+ * hamt_insert - Insert a new key-data pair to the map.
+ * If a key exists already, the previous data will be overwritten.
+ * @arg map: The map
+ * @arg key: Pointer to the key value. For pointer keys the pointer itself.
+ * @arg data: The data to be stored
+ * @returns: Previous data assigned to this key, NULL if nothing was stored or a
+ * destructor is set. The destructor is called once no snapshot holds the data.
+ */
+void* hamt_insert( hamt_t* map, const void* key, const void* data )
+{
+	hamtnode_t* root;
+	hamtkey_t k;
+	const void* old = NULL;
+	bool owned, replaced = false;
+
+	assert( map != NULL );
+
+	k.hash = map->key_hash( key );
+	k.key = key;
+	k.data = data;
+
+	owned = __hamt_owned( map->root );
+	root = __hamt_insert( map, map->root, owned, 0, &k, &old, &replaced );
+
+	if ( !owned )
+		__hamt_node_release( map, map->root );
+
+	map->root = root;
+
+	if ( !replaced )
+	{
+		map->size++;
+		return NULL;
+	}
+
+	return map->data_destroy ? NULL : (void*)old;
+}
+
+/*
+ * hamt_erase - Remove a key and its data from the map.
+ * @arg map: The map
+ * @arg key: Pointer to the key value. For pointer keys the pointer itself.
+ * @returns: Removed data, NULL if nothing was stored or a destructor is set.
+ * The destructor is called once no snapshot holds the data.
+ */
+void* hamt_erase( hamt_t* map, const void* key )
+{
+	hamtnode_t* root;
+	hamtkey_t k;
+	const void* data = NULL;
+	bool owned, found = false;
+
+	assert( map != NULL );
+
+	k.hash = map->key_hash( key );
+	k.key = key;
+	k.data = NULL;
+
+	owned = __hamt_owned( map->root );
+	root = __hamt_erase( map, map->root, owned, 0, &k, &data, &found );
+
+	if ( !found ) return NULL;
+
+	if ( !owned )
+		__hamt_node_release( map, map->root );
+
+	map->root = root;
+	map->size--;
+
+	return map->data_destroy ? NULL : (void*)data;
+}
+
+/*
+ * hamt_find - Find the data matching a key.
+ * @arg map: The map or a snapshot to look from
+ * @arg key: Pointer to the key value. For pointer keys the pointer itself.
+ * @returns: Found data, or NULL if no data was found
+ */
+void* hamt_find( hamt_t* map, const void* key )
+{
+	hamtnode_t* node;
+	hamtleaf_t* leaf;
+	uint32 hash, bit, shift, i;
+
+	assert( map != NULL );
+
+	hash = map->key_hash( key );
+	node = map->root;
+
+	for ( shift = 0; shift < HAMT_HASH_BITS; shift += HAMT_BITS )
+	{
+		bit = __hamt_bit( hash, shift );
+
+		if ( node->datamap & bit )
+		{
+			leaf = node->slots[__hamt_popcount( node->datamap & ( bit - 1 ) )];
+
+			if ( leaf->hash == hash && map->key_equals( leaf->key, key ) )
+				return (void*)leaf->data;
+
+			return NULL;
+		}
+
+		if ( !( node->nodemap & bit ) ) return NULL;
+
+		node = node->slots[__hamt_popcount( node->datamap ) + __hamt_popcount( node->nodemap & ( bit - 1 ) )];
+	}
+
+	// Keys with the same full hash
+	for ( i = 0; i < node->count; i++ )
+	{
+		leaf = node->slots[i];
+
+		if ( leaf->hash == hash && map->key_equals( leaf->key, key ) )
+			return (void*)leaf->data;
+	}
+
+	return NULL;
+}
+
+/*
+ * hamt_clear - Remove all entries from a map. Snapshots of the map are not affected.
+ * @arg map: The map
+ */
+void hamt_clear( hamt_t* map )
+{
+	assert( map != NULL );
+
+	__hamt_node_release( map, map->root );
+
+	map->root = __hamt_node_create( 0, 0, 0 );
+	map->size = 0;
+}
@@ -0,0 +1,65 @@
+/**********************************************************************
+ *
+ * PROJECT:		Types library
+ * FILE:		Hamt.h
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		A persistent hash array mapped trie. Snapshots share
+ *				their nodes with the map and take O(1) time, updates
+ *				copy only the path to the changed entry. A map and its
+ *				snapshots may be used from different threads, a single
+ *				hamt_t may not.
+ *
+ *				(c) Tuomo Jauhiainen 2012
+ *
+ **********************************************************************/
+
+#pragma once
+#ifndef __MYLLY_HAMT_H
+#define __MYLLY_HAMT_H
+
+#include "stdtypes.h"
+#include "HashMap.h"
+
+#define HAMT_BITS		(5)					// Hash bits consumed by each level of the trie
+#define HAMT_FANOUT		(1 << HAMT_BITS)	// Slots in a node
+
+typedef struct {
+	volatile uint32		refs;			// Nodes referencing this leaf
+	uint32				hash;			// Full hash of the key
+	const void*			key;			// Key assigned to this leaf
+	const void*			data;			// Stored data
+} hamtleaf_t;
+
+typedef struct {
+	volatile uint32		refs;			// Nodes and maps referencing this node
+	uint32				datamap;		// Slots holding a leaf
+	uint32				nodemap;		// Slots holding a child node
+	uint32				count;			// Number of slots used, leaves first and child nodes after them
+	void*				slots[1];		// The leaves and child nodes, allocated to count
+} hamtnode_t;
+
+typedef struct {
+	hamtnode_t*			root;			// Root node, shared with the snapshots of the map
+	uint32				size;			// Number of elements stored
+	hash_func_t			key_hash;		// Hash function
+	key_func_t			key_equals;		// Key comparison function
+	key_dup_func_t		key_dup;		// Function to duplicate a key
+	data_destruct_t		key_free;		// Function to free a duplicated key
+	data_destruct_t		data_destroy;	// A custom destructor, called when no snapshot holds the data anymore
+} hamt_t;
+
+__BEGIN_DECLS
+
+MYLLY_API hamt_t*			hamt_create				( hashmap_key_type_t keys );
+MYLLY_API void				hamt_destroy			( hamt_t* map );
+MYLLY_API void				hamt_set_key_funcs		( hamt_t* map, const hashmap_key_funcs_t* funcs );
+MYLLY_API hamt_t*			hamt_snapshot			( hamt_t* map );
+
+MYLLY_API void*				hamt_insert				( hamt_t* map, const void* key, const void* data );
+MYLLY_API void*				hamt_erase				( hamt_t* map, const void* key );
+MYLLY_API void*				hamt_find				( hamt_t* map, const void* key );
+MYLLY_API void				hamt_clear				( hamt_t* map );
+
+__END_DECLS
+
+#endif /* __MYLLY_HAMT_H */
@@ -10,14 +10,173 @@
  **********************************************************************/
 
 #include "Types/HashMap.h"
+#include "Types/Thread.h"
 #include <malloc.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
 
-#define HASHMAP_INITIAL_CAPACITY	(100)
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+// Statistics are only collected when the library is built with MYLLY_HASHMAP_STATS.
+#ifdef MYLLY_HASHMAP_STATS
+	#include <time.h>
+	#define HASHMAP_STAT(x)			x
+#else
+	#define HASHMAP_STAT(x)
+#endif
+
+#define HASHMAP_INITIAL_CAPACITY	(128)
 #define HASHMAP_MAX_LOAD_FACTOR		(0.75f)
-#define HASHMAP_EXPANSION_FACTOR	(1.5f)
+#define HASHMAP_EXPANSION_FACTOR	(2)
+
+#define HASHMAP_TREEIFY_THRESHOLD	(8)			// Chain length at which a bucket is turned into a tree
+#define HASHMAP_UNTREEIFY_THRESHOLD	(6)			// Chain length below which a tree is turned back into a chain
+
+#define HASHMAP_NODE_BLOCK_MIN		(64)		// Nodes in the first slab block
+#define HASHMAP_NODE_BLOCK_MAX		(16384)		// Maximum nodes in a single slab block
+#define HASHMAP_ARENA_BLOCK_SIZE	(65536)		// Size of a single key arena block
+#define HASHMAP_ARENA_ALIGN			(8)			// Alignment of the keys in the arena
+#define HASHMAP_ARENA_HEADER		( ( sizeof(hashblock_t) + HASHMAP_ARENA_ALIGN - 1 ) & ~( HASHMAP_ARENA_ALIGN - 1 ) )
+
+// Secret constants of wyhash, see https://github.com/wangyi-fudan/wyhash
+#define HASHMAP_WY0					(0xa0761d6478bd642fULL)
+#define HASHMAP_WY1					(0xe7037ed1a0b428dbULL)
+#define HASHMAP_WY2					(0x8ebc6af09c88c6e3ULL)
+#define HASHMAP_WY3					(0x589965cc75374cc3ULL)
+
+// Control bytes of the flat engine. A full slot stores the low 7 bits of the hash.
+#define HASHMAP_CTRL_EMPTY			(0x80)
+#define HASHMAP_CTRL_DELETED		(0xFE)
+
+// The flat engine probes a whole group of control bytes with a single SIMD compare.
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define HASHMAP_GROUP_WIDTH		(32)
+	#define HASHMAP_GROUP_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+	#include <emmintrin.h>
+	#define HASHMAP_GROUP_WIDTH		(16)
+	#define HASHMAP_GROUP_SSE2
+#else
+	#define HASHMAP_GROUP_WIDTH		(16)
+#endif
+
+// Flat and dense maps share the control byte probing.
+#define HASHMAP_OPEN_ADDRESSING(map)	( (map)->engine == HASHMAP_FLAT || (map)->engine == HASHMAP_DENSE )
+
+// Maps using the default string key functions can handle keys with a known length.
+#define HASHMAP_STRING_KEYS(map)	( (map)->key_hash == __hashmap_hash && (map)->key_equals == __hashmap_key_equal && (map)->key_dup == __hashmap_key_dup && (map)->key_size == __hashmap_key_size )
+
+// Keys are copied into the arena (or the node) only while key_dup is the default one. Callers
+// who replace the key functions by assigning the fields of the map keep key_dup and key_free.
+#define HASHMAP_ARENA_KEYS(map)		( (map)->key_size != NULL && (map)->key_dup == __hashmap_key_dup )
+#define HASHMAP_NO_LEN				( (size_t)-1 )
+
+// Room for a small key right after a node of the chained engine.
+#define HASHMAP_NODE_KEY(node)		( (void*)( (node) + 1 ) )
+
+// Integer and pointer keys are stored in the nodes themselves.
+#define HASHMAP_INLINE_KEYS(map)	( (map)->key_type != HASHMAP_KEY_STRING )
+
+// A key resolved for a single operation.
+typedef struct {
+	const void*		ptr;			// Key passed by the caller, unused for inline keys
+	uint64			value;			// Value of an inline key
+	size_t			len;			// Length of a string key, HASHMAP_NO_LEN if unknown
+	uint32			hash;			// Full hash of the key
+} hashkey_t;
+
+// A group of nodes sharing the same full hash in a treeified bucket. The nodes
+// of a group are kept next to each other in the chain of the bucket.
+typedef struct {
+	tnode_t			node;			// Tree node, keyed on the full hash of the group
+	hashnode_t**	link;			// Link pointing to the first node of the group
+} hashtree_t;
+
+// A range of keys hashed by a single thread of hashmap_build_from_arrays.
+typedef struct {
+	hashmap_t*			map;		// The map being built
+	const void* const*	keys;		// All the keys to build the map from
+	hashkey_t*			resolved;	// Resolved keys, one for each key
+	uint32				first;		// First key of the range
+	uint32				last;		// One past the last key of the range
+} hashbuild_t;
+
+// A parallel pass over the buckets (or slots) of a map. The threads claim small
+// chunks of the work until none are left, so a thread stuck on long chains simply
+// ends up claiming fewer chunks than the others.
+typedef struct hashpar_s {
+	hashmap_t*			map;		// The map being processed
+	hashnode_t**		nodes;		// Bucket array being processed, NULL for the flat and dense engines
+	uint32				buckets;	// Number of buckets in the array
+	uint32				count;		// Number of work items
+	volatile uint32		next;		// First work item not claimed yet
+	void				( *func )( struct hashpar_s* par, uint32 first, uint32 last ); // Processes a range of work items
+} hashpar_t;
+
+// Position of a key in a frozen snapshot, derived from its hash.
+typedef struct {
+	uint32			bucket;			// Displacement bucket of the key
+	uint32			f1;				// Initial slot of the key
+	uint32			f2;				// Slot step of the key, multiplied by the first displacement
+} hashfrozen_pos_t;
+
+// A key of a frozen snapshot under construction.
+typedef struct {
+	uint64			key;			// Integer or pointer key, or pointer to the key
+	const void*		data;			// Stored data
+	hashfrozen_pos_t pos;			// Position of the key
+	uint32			slot;			// Slot the key was placed in
+} hashfreeze_t;
+
+#ifdef _MSC_VER
+	#include <intrin.h>
+	#if defined(_M_X64)
+		#pragma intrinsic(_umul128)
+	#endif
+#endif
+
+// Software prefetch used by the batched operations.
+#if defined(_MSC_VER) && ( defined(_M_X64) || defined(_M_IX86) )
+	#define HASHMAP_PREFETCH(ptr)	_mm_prefetch( (const char*)(ptr), _MM_HINT_T0 )
+#elif defined(__GNUC__)
+	#define HASHMAP_PREFETCH(ptr)	__builtin_prefetch( (ptr) )
+#else
+	#define HASHMAP_PREFETCH(ptr)	( (void)(ptr) )
+#endif
+
+#define HASHMAP_FILTER_WORDS		(8)			// 32-bit words in a filter block, one bit is set in each
+#define HASHMAP_FILTER_BLOCK		( HASHMAP_FILTER_WORDS * sizeof(uint32) )
+#define HASHMAP_FILTER_MIN_KEYS		(1024)		// Smallest number of keys a filter is sized for
+
+// Salts of the split block Bloom filter, one for each word of a block.
+static const uint32 hashmap_filter_salt[HASHMAP_FILTER_WORDS] = {
+	0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d, 0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31
+};
+
+#define HASHMAP_BATCH_SIZE			(16)		// Keys resolved per pipelined pass of a batch
+#define HASHMAP_BUILD_MIN_KEYS		(4096)		// Minimum keys hashed by each thread of a bulk build
+#define HASHMAP_PARALLEL_MIN		(65536)		// Minimum buckets (or slots) processed by each thread of a parallel rehash or clear
+#define HASHMAP_PARALLEL_CHUNK		(1024)		// Buckets (or slots) claimed at once by a thread of a parallel rehash or clear
+
+#define HASHMAP_FROZEN_MAGIC		(0x5A465948)	// "HYFZ"
+#define HASHMAP_FROZEN_VERSION		(2)
+#define HASHMAP_FROZEN_BUCKET_KEYS	(2)			// Average keys per displacement bucket, larger buckets build slower
+#define HASHMAP_FROZEN_MAX_TRIES	(1 << 20)	// Displacements tried for a single bucket before picking a new seed
+#define HASHMAP_FROZEN_MAX_SEEDS	(32)		// Seeds tried before giving up
+
+// Size of a part of a frozen snapshot rounded up to keep the next part aligned.
+#define HASHMAP_FROZEN_ALIGN(size)			( ( (uint64)(size) + HASHMAP_ARENA_ALIGN - 1 ) & ~(uint64)( HASHMAP_ARENA_ALIGN - 1 ) )
+
+// Address of a part of a frozen snapshot.
+#define HASHMAP_FROZEN_AT(frozen,offset)	( (const void*)( (const uint8*)(frozen) + (offset) ) )
 
 /*
  * __hashmap_alloc - An allocator func with further error
@@ -46,23 +205,228 @@ static void __hashmap_free( const void* ptr )
 	free( (void*)ptr );
 }
 
+#ifdef MYLLY_HASHMAP_STATS
+
 /*
- * __hashmap_hash - Default hasher function.
- * djb2 hash from http://www.cse.yorku.ca/~oz/hash.html
- * @arg key: Pointer to key
+ * __hashmap_usecs - Read a monotonic clock for the rehash timings.
+ * @returns: Current time in microseconds
+ */
+static uint64 __hashmap_usecs( void )
+{
+#ifdef _WIN32
+	LARGE_INTEGER counter, frequency;
+
+	QueryPerformanceCounter( &counter );
+	QueryPerformanceFrequency( &frequency );
+
+	return (uint64)( counter.QuadPart / frequency.QuadPart * 1000000 +
+					 counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart );
+#else
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+
+	return (uint64)now.tv_sec * 1000000 + (uint64)now.tv_nsec / 1000;
+#endif
+}
+
+/*
+ * __hashmap_stats_lookup - Record a finished lookup.
+ * @arg map: Hashmap
+ * @arg probes: Nodes, slot groups or frozen slots visited by the lookup
+ */
+static MYLLY_INLINE void __hashmap_stats_lookup( hashmap_t* map, uint32 probes )
+{
+	map->counters.lookups++;
+	map->counters.probes += probes;
+
+	if ( probes > map->counters.max_probes )
+		map->counters.max_probes = probes;
+}
+
+#endif /* MYLLY_HASHMAP_STATS */
+
+/*
+ * __hashmap_mul128 - Multiply two 64-bit values into a 128-bit product.
+ * @arg a: First factor, receives the low half of the product
+ * @arg b: Second factor, receives the high half of the product
+ * @returns: -
+ */
+static MYLLY_INLINE void __hashmap_mul128( uint64* a, uint64* b )
+{
+#if defined(__SIZEOF_INT128__)
+	__uint128_t r = (__uint128_t)*a * *b;
+	*a = (uint64)r;
+	*b = (uint64)( r >> 64 );
+#elif defined(_MSC_VER) && defined(_M_X64)
+	*a = _umul128( *a, *b, b );
+#else
+	uint64 ha = *a >> 32, hb = *b >> 32, la = (uint32)*a, lb = (uint32)*b;
+	uint64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64 t = rl + ( rm0 << 32 ), c = t < rl, lo;
+
+	lo = t + ( rm1 << 32 );
+	c += lo < t;
+
+	*a = lo;
+	*b = rh + ( rm0 >> 32 ) + ( rm1 >> 32 ) + c;
+#endif
+}
+
+/*
+ * __hashmap_mum - Multiply two 64-bit values and fold the 128-bit product.
+ * @arg a: First factor
+ * @arg b: Second factor
+ * @returns: The high and low halves of the product xored together
+ */
+static MYLLY_INLINE uint64 __hashmap_mum( uint64 a, uint64 b )
+{
+	__hashmap_mul128( &a, &b );
+	return a ^ b;
+}
+
+/*
+ * __hashmap_read64 - Read an unaligned little endian 64-bit value.
+ */
+static MYLLY_INLINE uint64 __hashmap_read64( const uint8* p )
+{
+	uint64 v;
+	memcpy( &v, p, sizeof(v) );
+	return v;
+}
+
+/*
+ * __hashmap_read32 - Read an unaligned little endian 32-bit value.
+ */
+static MYLLY_INLINE uint64 __hashmap_read32( const uint8* p )
+{
+	uint32 v;
+	memcpy( &v, p, sizeof(v) );
+	return v;
+}
+
+/*
+ * __hashmap_wyhash - Hash a block of memory into 64 bits.
+ * This is wyhash, which consumes the input 8 to 48 bytes at a time.
+ * @arg data: Pointer to the data to be hashed
+ * @arg len: Length of the data in bytes
+ * @arg seed: Seed for the hash
  * @returns: Calculated hash
  */
-static uint32 __hashmap_hash( const void* key )
+static uint64 __hashmap_wyhash( const void* data, size_t len, uint64 seed )
 {
-	register char* s;
-	register size_t hash = 5381;
+	const uint8* p = (const uint8*)data;
+	uint64 a, b, see1, see2;
+	size_t i;
 
-	for ( s = (char*)key; *s; s++ )
+	seed ^= __hashmap_mum( seed ^ HASHMAP_WY0, HASHMAP_WY1 );
+
+	if ( len <= 16 )
 	{
-		hash = ( (hash << 5) + hash ) + *s;
+		if ( len >= 4 )
+		{
+			a = ( __hashmap_read32( p ) << 32 ) | __hashmap_read32( p + ( ( len >> 3 ) << 2 ) );
+			b = ( __hashmap_read32( p + len - 4 ) << 32 ) | __hashmap_read32( p + len - 4 - ( ( len >> 3 ) << 2 ) );
+		}
+		else if ( len > 0 )
+		{
+			a = ( (uint64)p[0] << 16 ) | ( (uint64)p[len >> 1] << 8 ) | p[len - 1];
+			b = 0;
+		}
+		else
+		{
+			a = b = 0;
+		}
 	}
+	else
+	{
+		i = len;
 
-	return hash;
+		if ( i > 48 )
+		{
+			see1 = see2 = seed;
+
+			do
+			{
+				seed = __hashmap_mum( __hashmap_read64( p ) ^ HASHMAP_WY1, __hashmap_read64( p + 8 ) ^ seed );
+				see1 = __hashmap_mum( __hashmap_read64( p + 16 ) ^ HASHMAP_WY2, __hashmap_read64( p + 24 ) ^ see1 );
+				see2 = __hashmap_mum( __hashmap_read64( p + 32 ) ^ HASHMAP_WY3, __hashmap_read64( p + 40 ) ^ see2 );
+				p += 48;
+				i -= 48;
+			}
+			while ( i > 48 );
+
+			seed ^= see1 ^ see2;
+		}
+
+		while ( i > 16 )
+		{
+			seed = __hashmap_mum( __hashmap_read64( p ) ^ HASHMAP_WY1, __hashmap_read64( p + 8 ) ^ seed );
+			p += 16;
+			i -= 16;
+		}
+
+		a = __hashmap_read64( p + i - 16 );
+		b = __hashmap_read64( p + i - 8 );
+	}
+
+	a ^= HASHMAP_WY1;
+	b ^= seed;
+
+	__hashmap_mul128( &a, &b );
+
+	return __hashmap_mum( a ^ HASHMAP_WY0 ^ len, b ^ HASHMAP_WY1 );
+}
+
+/*
+ * hashmap_hash_bytes - Hash a block of memory.
+ * @arg data: Pointer to the data to be hashed
+ * @arg len: Length of the data in bytes
+ * @arg seed: Seed for the hash
+ * @returns: Calculated hash, wyhash folded to 32 bits
+ */
+uint32 hashmap_hash_bytes( const void* data, size_t len, uint64 seed )
+{
+	uint64 hash = __hashmap_wyhash( data, len, seed );
+
+	return (uint32)( hash ^ ( hash >> 32 ) );
+}
+
+/*
+ * __hashmap_fmix64 - Integer finalizer from MurmurHash3. This is a bijection,
+ * so distinct integers never collide.
+ * @arg key: The integer to be hashed
+ * @returns: Calculated hash
+ */
+static MYLLY_INLINE uint64 __hashmap_fmix64( uint64 key )
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+
+	return key;
+}
+
+/*
+ * __hashmap_mix64 - Hash an integer key.
+ * @arg key: The integer to be hashed
+ * @returns: Calculated hash
+ */
+static MYLLY_INLINE uint32 __hashmap_mix64( uint64 key )
+{
+	return (uint32)__hashmap_fmix64( key );
+}
+
+/*
+ * __hashmap_hash - Default hasher function for string keys.
+ * @arg key: Pointer to key
+ * @returns: Calculated hash
+ */
+static uint32 __hashmap_hash( const void* key )
+{
+	return hashmap_hash_bytes( key, strlen( (const char*)key ), 0 );
 }
 
 /*
@@ -105,289 +469,3748 @@ static void* __hashmap_key_dup( const void* key )
 }
 
 /*
- * hashmap_create - Create and initialize a hashmap.
- * @returns: The created hashmap
+ * __hashmap_key_size - Default key size function.
+ * @arg key: A string key
+ * @returns: Length of the string including the terminator
  */
-hashmap_t* hashmap_create( uint32 size )
+static size_t __hashmap_key_size( const void* key )
 {
-	hashmap_t* map;
+	return strlen( (const char*)key ) + 1;
+}
 
-	map = __hashmap_alloc( sizeof(*map) );
+/*
+ * __hashmap_key_size_uint32 - Key size function for keys pointing to a uint32.
+ */
+static size_t __hashmap_key_size_uint32( const void* key )
+{
+	UNREFERENCED_PARAM(key);
+	return sizeof(uint32);
+}
 
-	map->size = 0;
-	map->bucket_count = size ? size : HASHMAP_INITIAL_CAPACITY;
-	map->load_factor = 0;
-	map->max_load_factor = HASHMAP_MAX_LOAD_FACTOR;
-	map->key_hash = __hashmap_hash;
-	map->key_equals = __hashmap_key_equal;
-	map->key_dup = __hashmap_key_dup;
-	map->data_destroy = NULL;
+/*
+ * __hashmap_key_size_uint64 - Key size function for keys pointing to a uint64.
+ */
+static size_t __hashmap_key_size_uint64( const void* key )
+{
+	UNREFERENCED_PARAM(key);
+	return sizeof(uint64);
+}
 
-	map->nodes = __hashmap_alloc( sizeof(hashnode_t*) * map->bucket_count );
-	memset( map->nodes, 0, sizeof(hashnode_t*) * map->bucket_count );
+/*
+ * __hashmap_hash_uint32 - Hasher function for keys pointing to a uint32.
+ */
+static uint32 __hashmap_hash_uint32( const void* key )
+{
+	return __hashmap_mix64( *(const uint32*)key );
+}
 
-	return map;
+/*
+ * __hashmap_key_equal_uint32 - Comparison function for keys pointing to a uint32.
+ */
+static bool __hashmap_key_equal_uint32( const void* key1, const void* key2 )
+{
+	return *(const uint32*)key1 == *(const uint32*)key2;
 }
 
 /*
- * hashmap_destroy - Destroy and free a hashmap.
- * @arg map: Pointer to the hashmap to be destroyed.
+ * __hashmap_key_dup_uint32 - Duplication function for keys pointing to a uint32.
  */
-void hashmap_destroy( hashmap_t* map )
+static void* __hashmap_key_dup_uint32( const void* key )
 {
-	assert( map != NULL );
-	assert( map->nodes != NULL );
+	uint32* copy;
 
-	hashmap_clear( map );
+	copy = __hashmap_alloc( sizeof(*copy) );
+	*copy = *(const uint32*)key;
 
-	__hashmap_free( map->nodes );
-	map->nodes = 0;
+	return copy;
+}
 
-	__hashmap_free( map );
-	map = 0;
+/*
+ * __hashmap_hash_uint64 - Hasher function for keys pointing to a uint64.
+ */
+static uint32 __hashmap_hash_uint64( const void* key )
+{
+	return __hashmap_mix64( *(const uint64*)key );
 }
 
 /*
- * __hashmap_node_create - A helper func to create a new hashnode.
- * @arg map: Hashmap.
- * @arg key: Pointer to the key value.
- * @arg data: The data to be stored.
- * @returns: Pointer to the new hash node
+ * __hashmap_key_equal_uint64 - Comparison function for keys pointing to a uint64.
  */
-static hashnode_t* __hashmap_node_create( hashmap_t* map, const void* key, const void* data )
+static bool __hashmap_key_equal_uint64( const void* key1, const void* key2 )
 {
-	hashnode_t* node;
+	return *(const uint64*)key1 == *(const uint64*)key2;
+}
 
-	node = __hashmap_alloc( sizeof(*node) );
-	node->key = map->key_dup( key );
-	node->data = data;
-	node->next = NULL;
-	
-	map->size++;
-	map->load_factor = (float)map->size / map->bucket_count;
+/*
+ * __hashmap_key_dup_uint64 - Duplication function for keys pointing to a uint64.
+ */
+static void* __hashmap_key_dup_uint64( const void* key )
+{
+	uint64* copy;
 
-	return node;
+	copy = __hashmap_alloc( sizeof(*copy) );
+	*copy = *(const uint64*)key;
+
+	return copy;
 }
 
 /*
- * hashmap_insert - Insert a new key-data pair to the table.
- * If a key exists already, the previous data will be overwritten.
- * @arg map: Hashmap.
- * @arg key: Pointer to the key value.
- * @arg data: The data to be stored.
- * @returns: Previous data assigned to this key, NULL if nothing was stored
+ * __hashmap_hash_pointer - Hasher function for pointer keys.
+ * The pointer itself is the key, it is never dereferenced.
  */
-void* hashmap_insert( hashmap_t* map, const void* key, const void* data )
+static uint32 __hashmap_hash_pointer( const void* key )
 {
-	hashnode_t *node, *newnode;
-	void* old;
-	uint32 hash;
-
-	assert( map != NULL );
-	assert( map->nodes != NULL );
+	return __hashmap_mix64( (uint64)(size_t)key );
+}
 
-	hash = map->key_hash( key ) % map->bucket_count;
-	node = map->nodes[hash];
+/*
+ * __hashmap_key_equal_pointer - Comparison function for pointer keys.
+ */
+static bool __hashmap_key_equal_pointer( const void* key1, const void* key2 )
+{
+	return key1 == key2;
+}
 
-	if ( node )
-	{
-		for ( ; node; node = node->next )
-		{
-			if ( map->key_equals( key, node->key ) )
-			{
-				old = (void*)node->data;
-				node->data = data;
-				
-				if ( map->data_destroy )
-				{
-					map->data_destroy( old );
-					return NULL;
-				}
+/*
+ * __hashmap_key_dup_pointer - Duplication function for pointer keys.
+ * Pointer keys are stored as is.
+ */
+static void* __hashmap_key_dup_pointer( const void* key )
+{
+	return (void*)key;
+}
 
-				return old;
-			}
-		}
-	}
+/*
+ * __hashmap_key_free_pointer - Key free function for pointer keys, does nothing.
+ */
+static void __hashmap_key_free_pointer( const void* key )
+{
+	UNREFERENCED_PARAM(key);
+}
 
-	newnode = __hashmap_node_create( map, key, data );
-	newnode->next = map->nodes[hash];
+// Ready-made key function sets, indexed by hashmap_key_type_t.
+static const hashmap_key_funcs_t hashmap_key_types[HASHMAP_KEY_TYPES] = {
+	{ __hashmap_hash, __hashmap_key_equal, __hashmap_key_dup, __hashmap_free, __hashmap_key_size },
+	{ __hashmap_hash_uint32, __hashmap_key_equal_uint32, __hashmap_key_dup_uint32, __hashmap_free, __hashmap_key_size_uint32 },
+	{ __hashmap_hash_uint64, __hashmap_key_equal_uint64, __hashmap_key_dup_uint64, __hashmap_free, __hashmap_key_size_uint64 },
+	{ __hashmap_hash_pointer, __hashmap_key_equal_pointer, __hashmap_key_dup_pointer, __hashmap_key_free_pointer, NULL },
+};
 
-	map->nodes[hash] = newnode;
-	
-	if ( map->load_factor > map->max_load_factor )
-		hashmap_rehash( map, (uint32)( HASHMAP_EXPANSION_FACTOR * map->bucket_count ) + 1 );
+/*
+ * hashmap_key_funcs - Get the ready-made key functions for a key type.
+ * @arg type: The key type
+ * @returns: Hash, comparison, duplication and free functions for the key type
+ */
+const hashmap_key_funcs_t* hashmap_key_funcs( hashmap_key_type_t type )
+{
+	assert( type < HASHMAP_KEY_TYPES );
 
-	return NULL;
+	return &hashmap_key_types[type];
 }
 
 /*
- * hashmap_erase - Remove a key-data pair from the table.
- * @arg map: The hashmap to remove from.
- * @arg key: Pointer to the key value.
- * @returns: Removed data, NULL if nothing was stored or a destructor was called
+ * hashmap_set_key_funcs - Set the key functions of an empty hashmap.
+ * @arg map: Hashmap
+ * @arg funcs: The key functions to use
  */
-void* hashmap_erase( hashmap_t* map, const void* key )
+void hashmap_set_key_funcs( hashmap_t* map, const hashmap_key_funcs_t* funcs )
 {
-	hashnode_t *node, *prev, *first;
-	void* data;
-	uint32 hash;
-
 	assert( map != NULL );
-	assert( map->nodes != NULL );
-
-	hash = map->key_hash( key ) % map->bucket_count;
-	node = map->nodes[hash];
+	assert( funcs != NULL );
+	assert( map->size == 0 ); // Existing keys would be freed with the wrong functions
 
-	if ( !node ) return NULL;
+	map->key_hash = funcs->key_hash;
+	map->key_equals = funcs->key_equals;
+	map->key_dup = funcs->key_dup;
+	map->key_free = funcs->key_free;
+	map->key_size = funcs->key_size;
+	map->key_type = HASHMAP_KEY_STRING;
+}
 
-	for ( first = node, prev = NULL; node; prev = node, node = node->next )
+/*
+ * __hashmap_key_value - Get the value of an integer or pointer key passed to a public operation.
+ * @arg map: Hashmap
+ * @arg key: The key as passed by the caller
+ * @returns: Value of the key, 0 for keys handled by the key functions
+ */
+static MYLLY_INLINE uint64 __hashmap_key_value( hashmap_t* map, const void* key )
+{
+	switch ( map->key_type )
 	{
-		if ( map->key_equals( key, node->key ) )
-		{
-			if ( prev )
-				prev->next = node->next;
-
-			if ( node == first )
-				map->nodes[hash] = node->next;
+	case HASHMAP_KEY_UINT32:
+		return *(const uint32*)key;
 
-			data = (void*)node->data;
+	case HASHMAP_KEY_UINT64:
+		return *(const uint64*)key;
 
-			__hashmap_free( node->key );
-			__hashmap_free( node );
+	case HASHMAP_KEY_POINTER:
+		return (uint64)(size_t)key;
 
-			map->size--;
+	default:
+		return 0;
+	}
+}
 
-			if ( map->data_destroy )
-			{
-				map->data_destroy( node->data );
-				return NULL;
-			}
+/*
+ * __hashmap_resolve_key - Resolve the key passed to a public operation, except for its hash.
+ * The length of a string key is measured once here and reused by the hash, the
+ * comparisons and the copy of the key.
+ * @arg map: Hashmap
+ * @arg key: The key as passed by the caller
+ * @arg out: The resolved key
+ */
+static MYLLY_INLINE void __hashmap_resolve_key( hashmap_t* map, const void* key, hashkey_t* out )
+{
+	out->ptr = key;
+	out->value = __hashmap_key_value( map, key );
+	out->len = HASHMAP_STRING_KEYS( map ) ? strlen( (const char*)key ) : HASHMAP_NO_LEN;
+}
 
-			return data;
-		}
-	}
+/*
+ * __hashmap_make_key - Resolve the key passed to a public operation.
+ * @arg map: Hashmap
+ * @arg key: The key as passed by the caller
+ * @arg out: The resolved key
+ */
+static MYLLY_INLINE void __hashmap_make_key( hashmap_t* map, const void* key, hashkey_t* out )
+{
+	__hashmap_resolve_key( map, key, out );
 
-	return NULL;
+	if ( HASHMAP_INLINE_KEYS( map ) )
+		out->hash = __hashmap_mix64( out->value );
+	else if ( out->len != HASHMAP_NO_LEN )
+		out->hash = hashmap_hash_bytes( key, out->len, 0 );
+	else
+		out->hash = map->key_hash( key );
 }
 
 /*
- * hashmap_find - Find a data pointer matching the given key.
- * @arg map: Hashmap to look from
- * @arg key: The key
- * @returns: Found data, or NULL if no data was found.
+ * __hashmap_make_key_n - Resolve a string key given as a pointer and a length.
+ * @arg map: Hashmap using the default string key functions
+ * @arg key: The characters of the key, not necessarily NUL-terminated
+ * @arg len: Number of characters in the key
+ * @arg out: The resolved key
  */
-void* hashmap_find( hashmap_t* map, const void* key )
+static MYLLY_INLINE void __hashmap_make_key_n( hashmap_t* map, const char* key, size_t len, hashkey_t* out )
 {
-	hashnode_t* node;
-	uint32 hash;
+	assert( HASHMAP_STRING_KEYS( map ) );
+	UNREFERENCED_PARAM(map);
 
-	assert( map != NULL );
-	assert( map->nodes != NULL );
+	out->ptr = key;
+	out->value = 0;
+	out->len = len;
+	out->hash = hashmap_hash_bytes( key, len, 0 );
+}
 
-	hash = map->key_hash( key ) % map->bucket_count;
-	node = map->nodes[hash];
+/*
+ * __hashmap_make_int_key - Resolve an integer key of a map with inline keys.
+ * @arg map: Hashmap
+ * @arg key: The key value
+ * @arg out: The resolved key
+ */
+static MYLLY_INLINE void __hashmap_make_int_key( hashmap_t* map, uint64 key, hashkey_t* out )
+{
+	assert( HASHMAP_INLINE_KEYS( map ) );
+	UNREFERENCED_PARAM(map);
 
-	if ( node )
-	{
-		for ( ; node; node = node->next )
+	out->ptr = NULL;
+	out->value = key;
+	out->len = HASHMAP_NO_LEN;
+	out->hash = __hashmap_mix64( key );
+}
+
+/*
+ * __hashmap_string_matches - Compare a stored string key to a string key of known length.
+ * The resolved key doesn't have to be NUL-terminated, but must not contain NUL characters.
+ * @arg stored: The stored key
+ * @arg k: The resolved key
+ * @returns: true if the keys are equal
+ */
+static MYLLY_INLINE bool __hashmap_string_matches( const void* stored, const hashkey_t* k )
+{
+	return strncmp( (const char*)stored, (const char*)k->ptr, k->len ) == 0 && ( (const char*)stored )[k->len] == '\0';
+}
+
+/*
+ * __hashmap_key_matches - Check whether a stored key equals a resolved key.
+ * The full hashes are compared first, inline keys are compared directly.
+ * @arg map: Hashmap
+ * @arg k: The resolved key
+ * @arg hash: Full hash of the stored key
+ * @arg key: The stored key
+ * @arg ikey: The stored key if the map has inline keys
+ * @returns: true if the keys are equal
+ */
+static MYLLY_INLINE bool __hashmap_key_matches( hashmap_t* map, const hashkey_t* k, uint32 hash, const void* key, uint64 ikey )
+{
+	if ( hash != k->hash ) return false;
+	if ( HASHMAP_INLINE_KEYS( map ) ) return ikey == k->value;
+
+	HASHMAP_STAT( map->counters.key_compares++ );
+
+	if ( k->len != HASHMAP_NO_LEN )
+		return __hashmap_string_matches( key, k );
+
+	return map->key_equals( k->ptr, key );
+}
+
+/*
+ * __hashmap_free_blocks - Free a list of slab or arena blocks.
+ * @arg block: The first block
+ */
+static void __hashmap_free_blocks( hashblock_t* block )
+{
+	hashblock_t* next;
+
+	for ( ; block; block = next )
+	{
+		next = block->next;
+		__hashmap_free( block );
+	}
+}
+
+/*
+ * __hashmap_node_alloc - Take a node from the node slab.
+ * When the slab runs out a whole block of nodes is allocated at once.
+ * @arg map: Hashmap
+ * @returns: An uninitialized node
+ */
+static hashnode_t* __hashmap_node_alloc( hashmap_t* map )
+{
+	hashblock_t* block;
+	hashnode_t* node;
+	uint8* nodes;
+	size_t stride;
+	uint32 i;
+
+	if ( !map->free_nodes )
+	{
+		// Every node is followed by room for a small key.
+		stride = sizeof(hashnode_t) + map->small_key_size;
+
+		block = __hashmap_alloc( sizeof(hashblock_t) + stride * map->node_block_size );
+		block->next = map->node_blocks;
+		map->node_blocks = block;
+
+		nodes = (uint8*)( block + 1 );
+
+		for ( i = 0; i < map->node_block_size - 1; i++ )
+			( (hashnode_t*)( nodes + i * stride ) )->next = (hashnode_t*)( nodes + ( i + 1 ) * stride );
+
+		( (hashnode_t*)( nodes + i * stride ) )->next = NULL;
+		map->free_nodes = (hashnode_t*)nodes;
+
+		HASHMAP_STAT( map->node_bytes += sizeof(hashblock_t) + stride * map->node_block_size );
+
+		// Grow the blocks with the map so large maps use a handful of blocks.
+		if ( map->node_block_size < HASHMAP_NODE_BLOCK_MAX )
+			map->node_block_size <<= 1;
+	}
+
+	node = map->free_nodes;
+	map->free_nodes = node->next;
+
+	return node;
+}
+
+/*
+ * __hashmap_node_release - Return a node to the slab for reuse.
+ * @arg map: Hashmap
+ * @arg node: The node to be released
+ */
+static MYLLY_INLINE void __hashmap_node_release( hashmap_t* map, hashnode_t* node )
+{
+	node->next = map->free_nodes;
+	map->free_nodes = node;
+}
+
+/*
+ * __hashmap_arena_alloc - Allocate memory for a key from the key arena.
+ * Released keys of the same size class are reused first. Keys too large
+ * for the size classes are allocated from the heap.
+ * @arg arena: The key arena
+ * @arg size: Size of the key in bytes
+ * @returns: Pointer to the allocated memory
+ */
+static void* __hashmap_arena_alloc( hasharena_t* arena, size_t size )
+{
+	hashblock_t* block;
+	size_t class;
+	void* ptr;
+
+	size = ( size + HASHMAP_ARENA_ALIGN - 1 ) & ~( HASHMAP_ARENA_ALIGN - 1 );
+	class = size / HASHMAP_ARENA_ALIGN - 1;
+
+	if ( class >= HASHMAP_ARENA_CLASSES )
+	{
+		arena->large_keys++;
+		HASHMAP_STAT( arena->bytes += size );
+
+		return __hashmap_alloc( size );
+	}
+
+	if ( arena->free[class] )
+	{
+		ptr = arena->free[class];
+		arena->free[class] = *(void**)ptr;
+		return ptr;
+	}
+
+	if ( arena->cursor + size > arena->end )
+	{
+		block = __hashmap_alloc( HASHMAP_ARENA_BLOCK_SIZE );
+		block->next = arena->blocks;
+		arena->blocks = block;
+
+		arena->cursor = (uint8*)block + HASHMAP_ARENA_HEADER;
+		arena->end = (uint8*)block + HASHMAP_ARENA_BLOCK_SIZE;
+
+		HASHMAP_STAT( arena->bytes += HASHMAP_ARENA_BLOCK_SIZE );
+	}
+
+	ptr = arena->cursor;
+	arena->cursor += size;
+
+	return ptr;
+}
+
+/*
+ * __hashmap_arena_release - Return a key to the arena free lists.
+ * @arg arena: The key arena
+ * @arg ptr: The key
+ * @arg size: Size of the key in bytes
+ */
+static void __hashmap_arena_release( hasharena_t* arena, const void* ptr, size_t size )
+{
+	size_t class;
+
+	size = ( size + HASHMAP_ARENA_ALIGN - 1 ) & ~( HASHMAP_ARENA_ALIGN - 1 );
+	class = size / HASHMAP_ARENA_ALIGN - 1;
+
+	if ( class >= HASHMAP_ARENA_CLASSES )
+	{
+		arena->large_keys--;
+		HASHMAP_STAT( arena->bytes -= size );
+
+		__hashmap_free( ptr );
+		return;
+	}
+
+	*(void**)ptr = arena->free[class];
+	arena->free[class] = (void*)ptr;
+}
+
+/*
+ * __hashmap_key_store - Make the map's own copy of a key.
+ * String keys of known length are copied without measuring them again.
+ * @arg map: Hashmap
+ * @arg k: The resolved key to be copied
+ * @returns: The stored key
+ */
+static void* __hashmap_key_store( hashmap_t* map, const hashkey_t* k )
+{
+	size_t size;
+	char* copy;
+
+	if ( !HASHMAP_ARENA_KEYS( map ) )
+		return map->key_dup( k->ptr );
+
+	if ( k->len != HASHMAP_NO_LEN )
+	{
+		copy = __hashmap_arena_alloc( &map->key_arena, k->len + 1 );
+
+		memcpy( copy, k->ptr, k->len );
+		copy[k->len] = '\0';
+
+		return copy;
+	}
+
+	size = map->key_size( k->ptr );
+	copy = __hashmap_arena_alloc( &map->key_arena, size );
+
+	memcpy( copy, k->ptr, size );
+
+	return copy;
+}
+
+/*
+ * __hashmap_key_release - Release a key stored with __hashmap_key_store.
+ * @arg map: Hashmap
+ * @arg key: The stored key
+ */
+static void __hashmap_key_release( hashmap_t* map, const void* key )
+{
+	if ( HASHMAP_INLINE_KEYS( map ) )
+		return;
+
+	if ( !HASHMAP_ARENA_KEYS( map ) )
+		map->key_free( key );
+	else
+		__hashmap_arena_release( &map->key_arena, key, map->key_size( key ) );
+}
+
+/*
+ * __hashmap_storage_reset - Release the node slab and the key arena all at once.
+ * Keys larger than the arena size classes must have been released already.
+ * @arg map: Hashmap
+ */
+static void __hashmap_storage_reset( hashmap_t* map )
+{
+	__hashmap_free_blocks( map->node_blocks );
+	__hashmap_free_blocks( map->key_arena.blocks );
+
+	map->node_blocks = NULL;
+	map->free_nodes = NULL;
+	map->node_block_size = HASHMAP_NODE_BLOCK_MIN;
+
+	memset( &map->key_arena, 0, sizeof(map->key_arena) );
+	HASHMAP_STAT( map->node_bytes = 0 );
+}
+
+/*
+ * __hashmap_key_clear - Release a key when the whole map is being cleared.
+ * Keys inside the arena blocks are skipped, the blocks are freed in bulk.
+ * Large keys are freed without touching the arena, which is reset afterwards,
+ * so several threads may clear keys of the same map at once.
+ * @arg map: Hashmap
+ * @arg key: The stored key
+ */
+static void __hashmap_key_clear( hashmap_t* map, const void* key )
+{
+	if ( HASHMAP_INLINE_KEYS( map ) )
+		return;
+
+	if ( !HASHMAP_ARENA_KEYS( map ) )
+		map->key_free( key );
+
+	else if ( map->key_size( key ) > HASHMAP_ARENA_CLASSES * HASHMAP_ARENA_ALIGN )
+		__hashmap_free( key );
+}
+
+/*
+ * __hashmap_clear_needs_walk - Check whether clearing the map has to visit every entry.
+ * @arg map: Hashmap
+ * @returns: true if there are destructors to call or keys outside the arena blocks
+ */
+static MYLLY_INLINE bool __hashmap_clear_needs_walk( hashmap_t* map )
+{
+	if ( map->data_destroy ) return true;
+
+	return !HASHMAP_INLINE_KEYS( map ) && ( !HASHMAP_ARENA_KEYS( map ) || map->key_arena.large_keys );
+}
+
+/*
+ * __hashmap_pow2 - Round a bucket count up to the next power of two.
+ * @arg count: Requested count
+ * @returns: The smallest power of two not less than count
+ */
+static uint32 __hashmap_pow2( uint32 count )
+{
+	uint32 pow2 = 1;
+
+	while ( pow2 < count )
+		pow2 <<= 1;
+
+	return pow2;
+}
+
+/*
+ * __hashmap_ctz - Count trailing zero bits of a non-zero mask.
+ * @arg mask: Bit mask, must not be zero
+ * @returns: Index of the lowest set bit
+ */
+static MYLLY_INLINE uint32 __hashmap_ctz( uint32 mask )
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward( &index, mask );
+	return (uint32)index;
+#else
+	return (uint32)__builtin_ctz( mask );
+#endif
+}
+
+/*
+ * __hashmap_group_match - Find the slots of a control group matching a byte.
+ * @arg ctrl: First control byte of the group
+ * @arg value: The control byte to look for
+ * @returns: A bit mask with a bit set for every matching slot
+ */
+static MYLLY_INLINE uint32 __hashmap_group_match( const uint8* ctrl, uint8 value )
+{
+#if defined(HASHMAP_GROUP_AVX2)
+	__m256i group = _mm256_loadu_si256( (const __m256i*)ctrl );
+	return (uint32)_mm256_movemask_epi8( _mm256_cmpeq_epi8( group, _mm256_set1_epi8( (char)value ) ) );
+#elif defined(HASHMAP_GROUP_SSE2)
+	__m128i group = _mm_loadu_si128( (const __m128i*)ctrl );
+	return (uint32)_mm_movemask_epi8( _mm_cmpeq_epi8( group, _mm_set1_epi8( (char)value ) ) );
+#else
+	uint32 i, mask = 0;
+
+	for ( i = 0; i < HASHMAP_GROUP_WIDTH; i++ )
+	{
+		if ( ctrl[i] == value ) mask |= 1u << i;
+	}
+
+	return mask;
+#endif
+}
+
+/*
+ * __hashmap_group_match_free - Find the empty or deleted slots of a control group.
+ * Both of them have the high bit set while full slots don't.
+ * @arg ctrl: First control byte of the group
+ * @returns: A bit mask with a bit set for every free slot
+ */
+static MYLLY_INLINE uint32 __hashmap_group_match_free( const uint8* ctrl )
+{
+#if defined(HASHMAP_GROUP_AVX2)
+	return (uint32)_mm256_movemask_epi8( _mm256_loadu_si256( (const __m256i*)ctrl ) );
+#elif defined(HASHMAP_GROUP_SSE2)
+	return (uint32)_mm_movemask_epi8( _mm_loadu_si128( (const __m128i*)ctrl ) );
+#else
+	uint32 i, mask = 0;
+
+	for ( i = 0; i < HASHMAP_GROUP_WIDTH; i++ )
+	{
+		if ( ctrl[i] & 0x80 ) mask |= 1u << i;
+	}
+
+	return mask;
+#endif
+}
+
+/*
+ * __hashmap_flat_mix - Spread the bits of a key hash for the flat engine.
+ * The low 7 bits end up in the control byte and the rest select the group.
+ * @arg hash: Hash returned by the key hash function
+ * @returns: Mixed hash
+ */
+static MYLLY_INLINE uint32 __hashmap_flat_mix( uint32 hash )
+{
+	hash ^= hash >> 16;
+	hash *= 0x85EBCA6B;
+	hash ^= hash >> 13;
+
+	return hash;
+}
+
+/*
+ * __hashmap_flat_capacity - Calculate the slot count of a flat map.
+ * The slot count is always a power of two and at least one full group.
+ * @arg map: Hashmap
+ * @arg slots: Requested number of slots
+ * @returns: Actual number of slots
+ */
+static uint32 __hashmap_flat_capacity( hashmap_t* map, uint32 slots )
+{
+	uint32 needed = (uint32)( map->size / map->max_load_factor ) + 1;
+
+	if ( slots < needed ) slots = needed;
+	if ( slots < HASHMAP_GROUP_WIDTH ) slots = HASHMAP_GROUP_WIDTH;
+
+	return __hashmap_pow2( slots );
+}
+
+/*
+ * __hashmap_flat_alloc - Allocate the control bytes and the slots of a flat map,
+ * or the control bytes, index table and entry array of a dense map.
+ * @arg map: Hashmap
+ * @arg capacity: Number of slots, a power of two multiple of the group width
+ */
+static void __hashmap_flat_alloc( hashmap_t* map, uint32 capacity )
+{
+	map->bucket_count = capacity;
+	map->tombstones = 0;
+
+	map->ctrl = __hashmap_alloc( capacity );
+	memset( map->ctrl, HASHMAP_CTRL_EMPTY, capacity );
+
+	if ( map->engine == HASHMAP_DENSE )
+	{
+		// The load factor limits the number of entries, erased ones included.
+		map->entry_capacity = (uint32)( capacity * map->max_load_factor ) + 1;
+		map->entry_count = 0;
+
+		map->index = __hashmap_alloc( sizeof(uint32) * capacity );
+		map->entries = __hashmap_alloc( sizeof(hashslot_t) * map->entry_capacity );
+	}
+	else
+	{
+		map->slots = __hashmap_alloc( sizeof(hashslot_t) * capacity );
+	}
+}
+
+/*
+ * __hashmap_flat_free - Free the arrays allocated by __hashmap_flat_alloc.
+ * @arg map: Hashmap
+ */
+static void __hashmap_flat_free( hashmap_t* map )
+{
+	__hashmap_free( map->ctrl );
+	__hashmap_free( map->slots );
+	__hashmap_free( map->index );
+	__hashmap_free( map->entries );
+
+	map->ctrl = NULL;
+	map->slots = NULL;
+	map->index = NULL;
+	map->entries = NULL;
+}
+
+/*
+ * __hashmap_flat_entry - Get the entry stored in a full slot of a flat or dense map.
+ * @arg map: Hashmap
+ * @arg slot: Index of the slot
+ * @returns: Pointer to the entry
+ */
+static MYLLY_INLINE hashslot_t* __hashmap_flat_entry( hashmap_t* map, uint32 slot )
+{
+	if ( map->engine == HASHMAP_DENSE )
+		return &map->entries[map->index[slot]];
+
+	return &map->slots[slot];
+}
+
+/*
+ * __hashmap_filter_block - Find the filter block of a hash and the bits the hash sets in it.
+ * The hash is remixed, so the block and the bits don't depend on the bucket bits.
+ * @arg map: Hashmap with a filter
+ * @arg hash: Full hash of the key
+ * @arg bits: Receives the bit set in each word of the block
+ * @returns: Pointer to the block
+ */
+static MYLLY_INLINE uint32* __hashmap_filter_block( const hashmap_t* map, uint32 hash, uint32* bits )
+{
+	uint64 mixed;
+	uint32 i;
+
+	mixed = __hashmap_fmix64( hash );
+
+	for ( i = 0; i < HASHMAP_FILTER_WORDS; i++ )
+		bits[i] = 1u << ( ( (uint32)mixed * hashmap_filter_salt[i] ) >> 27 );
+
+	return &map->filter[( (uint32)( mixed >> 32 ) & ( map->filter_blocks - 1 ) ) * HASHMAP_FILTER_WORDS];
+}
+
+/*
+ * __hashmap_filter_add - Add a hash to the filter.
+ * @arg map: Hashmap with a filter
+ * @arg hash: Full hash of the key
+ */
+static MYLLY_INLINE void __hashmap_filter_add( hashmap_t* map, uint32 hash )
+{
+	uint32 bits[HASHMAP_FILTER_WORDS];
+	uint32* block;
+	uint32 i;
+
+	block = __hashmap_filter_block( map, hash, bits );
+
+	for ( i = 0; i < HASHMAP_FILTER_WORDS; i++ )
+		block[i] |= bits[i];
+}
+
+/*
+ * __hashmap_filter_test - Check whether a key may be in the map. The whole test
+ * reads a single cache line.
+ * @arg map: Hashmap with a filter
+ * @arg hash: Full hash of the key
+ * @returns: false if the key is definitely not in the map
+ */
+static MYLLY_INLINE bool __hashmap_filter_test( const hashmap_t* map, uint32 hash )
+{
+	uint32 bits[HASHMAP_FILTER_WORDS];
+	const uint32* block;
+	uint32 i, missing = 0;
+
+	block = __hashmap_filter_block( map, hash, bits );
+
+	for ( i = 0; i < HASHMAP_FILTER_WORDS; i++ )
+		missing |= bits[i] & ~block[i];
+
+	return missing == 0;
+}
+
+/*
+ * __hashmap_filter_rejects - Check whether the filter of a map proves a key is missing.
+ * @arg map: Hashmap
+ * @arg hash: Full hash of the key
+ * @returns: true if the map has a filter and the key is definitely not in the map
+ */
+static MYLLY_INLINE bool __hashmap_filter_rejects( hashmap_t* map, uint32 hash )
+{
+	if ( !map->filter || __hashmap_filter_test( map, hash ) )
+		return false;
+
+	HASHMAP_STAT( map->counters.filtered++ );
+	HASHMAP_STAT( __hashmap_stats_lookup( map, 0 ) );
+
+	return true;
+}
+
+/*
+ * __hashmap_filter_free - Release the filter of a map.
+ * @arg map: Hashmap
+ */
+static void __hashmap_filter_free( hashmap_t* map )
+{
+	__hashmap_free( map->filter_alloc );
+
+	map->filter = NULL;
+	map->filter_alloc = NULL;
+	map->filter_blocks = 0;
+	map->filter_capacity = 0;
+	map->filter_erased = 0;
+}
+
+/*
+ * __hashmap_filter_rebuild - Size the filter for the current number of keys and add
+ * every key to it again. This drops the bits of erased keys as well.
+ * @arg map: Hashmap with filter_bits set
+ */
+static void __hashmap_filter_rebuild( hashmap_t* map )
+{
+	hashnode_t* node;
+	uint32 i, keys, blocks;
+
+	keys = map->size > HASHMAP_FILTER_MIN_KEYS / 2 ? 2 * map->size : HASHMAP_FILTER_MIN_KEYS;
+	blocks = __hashmap_pow2( (uint32)( ( (uint64)keys * map->filter_bits + HASHMAP_FILTER_BLOCK * 8 - 1 ) / ( HASHMAP_FILTER_BLOCK * 8 ) ) );
+
+	if ( blocks != map->filter_blocks )
+	{
+		__hashmap_filter_free( map );
+
+		// Align the blocks to cache lines, so testing a key touches only one.
+		map->filter_alloc = __hashmap_alloc( blocks * HASHMAP_FILTER_BLOCK + HASHMAP_FILTER_BLOCK - 1 );
+		map->filter = (uint32*)( ( (size_t)map->filter_alloc + HASHMAP_FILTER_BLOCK - 1 ) & ~( HASHMAP_FILTER_BLOCK - 1 ) );
+		map->filter_blocks = blocks;
+	}
+
+	memset( map->filter, 0, blocks * HASHMAP_FILTER_BLOCK );
+
+	map->filter_capacity = (uint32)( (uint64)blocks * HASHMAP_FILTER_BLOCK * 8 / map->filter_bits );
+	map->filter_erased = 0;
+
+	switch ( map->engine )
+	{
+	case HASHMAP_DENSE:
+		for ( i = 0; i < map->entry_count; i++ )
+		{
+			if ( !map->entries[i].erased )
+				__hashmap_filter_add( map, map->entries[i].hash );
+		}
+		break;
+
+	case HASHMAP_FLAT:
+		for ( i = 0; i < map->bucket_count; i++ )
+		{
+			if ( !( map->ctrl[i] & 0x80 ) )
+				__hashmap_filter_add( map, map->slots[i].hash );
+		}
+		break;
+
+	default:
+		for ( i = 0; i < map->bucket_count; i++ )
+		{
+			for ( node = map->nodes[i]; node; node = node->next )
+				__hashmap_filter_add( map, node->hash );
+		}
+
+		for ( i = map->rehash_index; i < map->old_bucket_count; i++ )
+		{
+			for ( node = map->old_nodes[i]; node; node = node->next )
+				__hashmap_filter_add( map, node->hash );
+		}
+		break;
+	}
+}
+
+/*
+ * __hashmap_filter_inserted - Add a new key to the filter, growing the filter
+ * once it holds more keys than it was sized for.
+ * @arg map: Hashmap with a filter
+ * @arg hash: Full hash of the key
+ */
+static void __hashmap_filter_inserted( hashmap_t* map, uint32 hash )
+{
+	if ( map->size > map->filter_capacity )
+		__hashmap_filter_rebuild( map );
+	else
+		__hashmap_filter_add( map, hash );
+}
+
+/*
+ * __hashmap_filter_erased - Count a key erased from the map. Its bits can't be
+ * cleared, so the filter is rebuilt once enough stale bits have piled up.
+ * @arg map: Hashmap with a filter
+ */
+static void __hashmap_filter_erased( hashmap_t* map )
+{
+	if ( ++map->filter_erased > map->filter_capacity / 2 )
+		__hashmap_filter_rebuild( map );
+}
+
+/*
+ * __hashmap_frozen_release - Free or unmap the snapshot of a frozen map.
+ * @arg map: Frozen map
+ */
+static void __hashmap_frozen_release( hashmap_t* map )
+{
+	if ( !map->frozen_mapped )
+	{
+		__hashmap_free( map->frozen );
+	}
+	else
+	{
+#ifdef _WIN32
+		UnmapViewOfFile( map->frozen );
+#else
+		munmap( map->frozen, (size_t)map->frozen->size );
+#endif
+	}
+
+	map->frozen = NULL;
+}
+
+/*
+ * hashmap_create - Create and initialize a hashmap.
+ * @arg size: Initial number of buckets, 0 for the default
+ * @returns: The created hashmap
+ */
+hashmap_t* hashmap_create( uint32 size )
+{
+	return hashmap_create_ex( size, HASHMAP_CHAINED, HASHMAP_KEY_STRING );
+}
+
+/*
+ * hashmap_create_ex - Create and initialize a hashmap using a specific storage engine.
+ * The bucket count is rounded up to a power of two.
+ * @arg size: Initial number of buckets (or slots), 0 for the default
+ * @arg engine: The storage engine to use
+ * @arg keys: Type of the keys, selects the hash and comparison functions
+ * @returns: The created hashmap
+ */
+hashmap_t* hashmap_create_ex( uint32 size, hashmap_engine_t engine, hashmap_key_type_t keys )
+{
+	hashmap_t* map;
+
+	assert( engine != HASHMAP_FROZEN ); // Frozen maps are created by hashmap_freeze
+
+	map = __hashmap_alloc( sizeof(*map) );
+
+	map->size = 0;
+	map->bucket_count = __hashmap_pow2( size ? size : HASHMAP_INITIAL_CAPACITY );
+	map->load_factor = 0;
+	map->max_load_factor = HASHMAP_MAX_LOAD_FACTOR;
+	map->engine = engine;
+	map->nodes = NULL;
+	map->trees = NULL;
+	map->ctrl = NULL;
+	map->slots = NULL;
+	map->tombstones = 0;
+	map->index = NULL;
+	map->entries = NULL;
+	map->entry_count = 0;
+	map->entry_capacity = 0;
+	map->frozen = NULL;
+	map->old_nodes = NULL;
+	map->old_bucket_count = 0;
+	map->rehash_index = 0;
+	map->rehash_step = 0;
+	map->node_blocks = NULL;
+	map->free_nodes = NULL;
+	map->node_block_size = HASHMAP_NODE_BLOCK_MIN;
+	map->small_key_size = 0;
+	map->filter = NULL;
+	map->filter_alloc = NULL;
+	map->filter_blocks = 0;
+	map->filter_bits = 0;
+	map->filter_capacity = 0;
+	map->filter_erased = 0;
+	map->data_destroy = NULL;
+
+	memset( &map->key_arena, 0, sizeof(map->key_arena) );
+
+	HASHMAP_STAT( memset( &map->counters, 0, sizeof(map->counters) ) );
+	HASHMAP_STAT( map->node_bytes = 0 );
+
+	hashmap_set_key_funcs( map, hashmap_key_funcs( keys ) );
+	map->key_type = keys;
+
+	hashmap_set_small_keys( map, HASHMAP_SMALL_KEY_SIZE );
+
+	if ( HASHMAP_OPEN_ADDRESSING( map ) )
+	{
+		__hashmap_flat_alloc( map, __hashmap_flat_capacity( map, map->bucket_count ) );
+		return map;
+	}
+
+	map->nodes = __hashmap_alloc( sizeof(hashnode_t*) * map->bucket_count );
+	memset( map->nodes, 0, sizeof(hashnode_t*) * map->bucket_count );
+
+	return map;
+}
+
+/*
+ * hashmap_destroy - Destroy and free a hashmap.
+ * @arg map: Pointer to the hashmap to be destroyed.
+ */
+void hashmap_destroy( hashmap_t* map )
+{
+	assert( map != NULL );
+
+	if ( map->engine == HASHMAP_FROZEN )
+	{
+		__hashmap_frozen_release( map );
+		__hashmap_free( map );
+		return;
+	}
+
+	hashmap_clear( map );
+
+	if ( HASHMAP_OPEN_ADDRESSING( map ) )
+	{
+		__hashmap_flat_free( map );
+	}
+	else
+	{
+		__hashmap_free( map->nodes );
+		map->nodes = 0;
+	}
+
+	__hashmap_filter_free( map );
+	__hashmap_free( map );
+	map = 0;
+}
+
+/*
+ * __hashmap_node_create - A helper func to create a new hashnode.
+ * @arg map: Hashmap.
+ * @arg k: The key.
+ * @arg data: The data to be stored.
+ * @returns: Pointer to the new hash node
+ */
+static hashnode_t* __hashmap_node_create( hashmap_t* map, const hashkey_t* k, const void* data )
+{
+	hashnode_t* node;
+	size_t size;
+
+	node = __hashmap_node_alloc( map );
+
+	if ( HASHMAP_INLINE_KEYS( map ) )
+	{
+		node->ikey = k->value;
+	}
+	else
+	{
+		size = 0;
+
+		if ( map->small_key_size && HASHMAP_ARENA_KEYS( map ) )
+			size = k->len != HASHMAP_NO_LEN ? k->len + 1 : map->key_size( k->ptr );
+
+		// Small keys are copied right after the node, so comparing them touches no extra cache lines.
+		if ( size && size <= map->small_key_size )
+		{
+			// A key with a known length may be a slice of a longer string, it gets its own terminator.
+			if ( k->len != HASHMAP_NO_LEN )
+			{
+				memcpy( HASHMAP_NODE_KEY( node ), k->ptr, k->len );
+				( (char*)HASHMAP_NODE_KEY( node ) )[k->len] = '\0';
+			}
+			else
+			{
+				memcpy( HASHMAP_NODE_KEY( node ), k->ptr, size );
+			}
+
+			node->key = HASHMAP_NODE_KEY( node );
+		}
+		else
+		{
+			node->key = __hashmap_key_store( map, k );
+		}
+	}
+
+	node->hash = k->hash;
+	node->data = data;
+	node->next = NULL;
+	
+	map->size++;
+	map->load_factor = (float)map->size / map->bucket_count;
+
+	return node;
+}
+
+/*
+ * __hashmap_flat_find_slot - Look for the slot holding a key in a flat map.
+ * @arg map: Hashmap
+ * @arg k: The key
+ * @returns: Index of the slot, or bucket_count if the key wasn't found
+ */
+static uint32 __hashmap_flat_find_slot( hashmap_t* map, const hashkey_t* k )
+{
+	uint32 mask, group, step, match, slot;
+	uint8 h2;
+	const uint8* ctrl;
+	const hashslot_t* entry;
+
+	mask = map->bucket_count / HASHMAP_GROUP_WIDTH - 1;
+	group = ( __hashmap_flat_mix( k->hash ) >> 7 ) & mask;
+	h2 = (uint8)( __hashmap_flat_mix( k->hash ) & 0x7F );
+
+	// Triangular probing over the groups visits every group exactly once.
+	for ( step = 0; step <= mask; step++ )
+	{
+		ctrl = &map->ctrl[group * HASHMAP_GROUP_WIDTH];
+
+		for ( match = __hashmap_group_match( ctrl, h2 ); match; match &= match - 1 )
+		{
+			slot = group * HASHMAP_GROUP_WIDTH + __hashmap_ctz( match );
+			entry = __hashmap_flat_entry( map, slot );
+
+			if ( __hashmap_key_matches( map, k, entry->hash, entry->key, entry->ikey ) )
+			{
+				HASHMAP_STAT( __hashmap_stats_lookup( map, step + 1 ) );
+				return slot;
+			}
+		}
+
+		// A group with an empty slot terminates every probe sequence passing through it.
+		if ( __hashmap_group_match( ctrl, HASHMAP_CTRL_EMPTY ) )
+			break;
+
+		group = ( group + step + 1 ) & mask;
+	}
+
+	HASHMAP_STAT( __hashmap_stats_lookup( map, step + 1 ) );
+
+	return map->bucket_count;
+}
+
+/*
+ * __hashmap_flat_claim - Claim the first free slot on the probe sequence of a hash.
+ * The key must not exist in the map already.
+ * @arg map: Hashmap
+ * @arg hash: Full hash of the key
+ * @returns: Index of the claimed slot, its control byte already set
+ */
+static uint32 __hashmap_flat_claim( hashmap_t* map, uint32 hash )
+{
+	uint32 mask, group, step, match, slot;
+
+	mask = map->bucket_count / HASHMAP_GROUP_WIDTH - 1;
+	group = ( __hashmap_flat_mix( hash ) >> 7 ) & mask;
+
+	for ( step = 0; step <= mask; step++ )
+	{
+		match = __hashmap_group_match_free( &map->ctrl[group * HASHMAP_GROUP_WIDTH] );
+
+		if ( match )
+		{
+			slot = group * HASHMAP_GROUP_WIDTH + __hashmap_ctz( match );
+
+			if ( map->ctrl[slot] == HASHMAP_CTRL_DELETED )
+				map->tombstones--;
+
+			map->ctrl[slot] = (uint8)( __hashmap_flat_mix( hash ) & 0x7F );
+			return slot;
+		}
+
+		group = ( group + step + 1 ) & mask;
+	}
+
+	assert( false ); // The load factor guarantees a free slot
+	return 0;
+}
+
+/*
+ * __hashmap_flat_place - Store an entry to a flat map, or append it to the
+ * entry array of a dense map. The key must not exist in the map already.
+ * @arg map: Hashmap
+ * @arg entry: The entry to store, the key already duplicated
+ */
+static void __hashmap_flat_place( hashmap_t* map, const hashslot_t* entry )
+{
+	uint32 slot;
+
+	slot = __hashmap_flat_claim( map, entry->hash );
+
+	if ( map->engine == HASHMAP_DENSE )
+	{
+		assert( map->entry_count < map->entry_capacity );
+
+		map->index[slot] = map->entry_count;
+		map->entries[map->entry_count] = *entry;
+		map->entries[map->entry_count].erased = false;
+		map->entry_count++;
+	}
+	else
+	{
+		map->slots[slot] = *entry;
+	}
+}
+
+/*
+ * __hashmap_flat_rehash - Move every entry of a flat or dense map into new arrays.
+ * The stored hashes are reused so the keys are never hashed again. The entry
+ * array of a dense map is compacted, keeping the insertion order.
+ * @arg map: Hashmap
+ * @arg capacity: New slot count
+ */
+static void __hashmap_flat_rehash( hashmap_t* map, uint32 capacity )
+{
+	uint8* ctrl;
+	uint32* index;
+	hashslot_t *slots, *entries;
+	uint32 i, old_capacity, old_entries;
+	HASHMAP_STAT( uint64 start = __hashmap_usecs() );
+
+	ctrl = map->ctrl;
+	slots = map->slots;
+	index = map->index;
+	entries = map->entries;
+	old_capacity = map->bucket_count;
+	old_entries = map->entry_count;
+
+	__hashmap_flat_alloc( map, capacity );
+
+	if ( map->engine == HASHMAP_DENSE )
+	{
+		for ( i = 0; i < old_entries; i++ )
+		{
+			if ( entries[i].erased ) continue;
+			__hashmap_flat_place( map, &entries[i] );
+		}
+	}
+	else
+	{
+		for ( i = 0; i < old_capacity; i++ )
+		{
+			if ( ctrl[i] & 0x80 ) continue;
+			__hashmap_flat_place( map, &slots[i] );
+		}
+	}
+
+	map->load_factor = (float)map->size / map->bucket_count;
+
+	__hashmap_free( ctrl );
+	__hashmap_free( slots );
+	__hashmap_free( index );
+	__hashmap_free( entries );
+
+	if ( map->filter )
+		__hashmap_filter_rebuild( map );
+
+	HASHMAP_STAT( map->counters.rehashes++ );
+	HASHMAP_STAT( map->counters.rehash_usecs += __hashmap_usecs() - start );
+}
+
+/*
+ * __hashmap_flat_insert - hashmap_insert for the flat and dense engines.
+ */
+static void* __hashmap_flat_insert( hashmap_t* map, const hashkey_t* k, const void* data )
+{
+	hashslot_t entry, *existing;
+	uint32 slot, used;
+	void* old;
+
+	slot = __hashmap_filter_rejects( map, k->hash ) ? map->bucket_count : __hashmap_flat_find_slot( map, k );
+
+	if ( slot != map->bucket_count )
+	{
+		existing = __hashmap_flat_entry( map, slot );
+
+		old = (void*)existing->data;
+		existing->data = data;
+
+		if ( map->data_destroy )
+		{
+			map->data_destroy( old );
+			return NULL;
+		}
+
+		return old;
+	}
+
+	// Erased slots (and erased dense entries) take up room too, so count them towards the load.
+	used = map->engine == HASHMAP_DENSE ? map->entry_count : map->size + map->tombstones;
+
+	if ( (float)( used + 1 ) > map->max_load_factor * map->bucket_count ||
+		 ( map->engine == HASHMAP_DENSE && map->entry_count >= map->entry_capacity ) )
+	{
+		if ( used - map->size > map->size / 2 )
+			__hashmap_flat_rehash( map, map->bucket_count );
+		else
+			__hashmap_flat_rehash( map, map->bucket_count * 2 );
+	}
+
+	entry.hash = k->hash;
+	entry.data = data;
+
+	if ( HASHMAP_INLINE_KEYS( map ) )
+		entry.ikey = k->value;
+	else
+		entry.key = __hashmap_key_store( map, k );
+
+	__hashmap_flat_place( map, &entry );
+
+	map->size++;
+	map->load_factor = (float)map->size / map->bucket_count;
+
+	if ( map->filter )
+		__hashmap_filter_inserted( map, k->hash );
+
+	return NULL;
+}
+
+/*
+ * __hashmap_flat_erase - hashmap_erase for the flat and dense engines.
+ */
+static void* __hashmap_flat_erase( hashmap_t* map, const hashkey_t* k )
+{
+	hashslot_t* entry;
+	uint32 slot;
+	void* data;
+	const uint8* group;
+
+	slot = __hashmap_flat_find_slot( map, k );
+	if ( slot == map->bucket_count ) return NULL;
+
+	entry = __hashmap_flat_entry( map, slot );
+
+	data = (void*)entry->data;
+	__hashmap_key_release( map, entry->key );
+
+	// Dense entries stay in place so the insertion order is kept, rehashing compacts them.
+	entry->erased = true;
+
+	// If the group of the slot still has an empty slot, no probe sequence can
+	// continue past it and the slot can be marked empty instead of deleted.
+	group = &map->ctrl[slot & ~( HASHMAP_GROUP_WIDTH - 1 )];
+
+	if ( __hashmap_group_match( group, HASHMAP_CTRL_EMPTY ) )
+	{
+		map->ctrl[slot] = HASHMAP_CTRL_EMPTY;
+	}
+	else
+	{
+		map->ctrl[slot] = HASHMAP_CTRL_DELETED;
+		map->tombstones++;
+	}
+
+	map->size--;
+	map->load_factor = (float)map->size / map->bucket_count;
+
+	if ( map->filter )
+		__hashmap_filter_erased( map );
+
+	if ( map->data_destroy )
+	{
+		map->data_destroy( data );
+		return NULL;
+	}
+
+	return data;
+}
+
+/*
+ * __hashmap_parallel_worker - Process chunks of a parallel pass until none are left.
+ * @arg arg: The hashpar_t describing the pass
+ */
+static void __hashmap_parallel_worker( void* arg )
+{
+	hashpar_t* par = arg;
+	uint32 first, last;
+
+	for ( ;; )
+	{
+		first = atomic_add_u32( &par->next, HASHMAP_PARALLEL_CHUNK ) - HASHMAP_PARALLEL_CHUNK;
+		if ( first >= par->count ) break;
+
+		last = par->count - first < HASHMAP_PARALLEL_CHUNK ? par->count : first + HASHMAP_PARALLEL_CHUNK;
+		par->func( par, first, last );
+	}
+}
+
+/*
+ * __hashmap_parallel_run - Run a parallel pass. The calling thread works along
+ * with the spawned ones, a single thread does the whole pass in one call.
+ * @arg par: The pass, with every field but next set
+ * @arg threads: Number of threads to use, 0 to use every CPU
+ */
+static void __hashmap_parallel_run( hashpar_t* par, uint32 threads )
+{
+	thread_t* workers;
+	uint32 i;
+
+	if ( threads == 0 ) threads = thread_cpu_count();
+
+	// Spawning threads only pays off when each of them gets a decent amount of work.
+	if ( threads > par->count / HASHMAP_PARALLEL_MIN ) threads = par->count / HASHMAP_PARALLEL_MIN;
+
+	if ( threads <= 1 )
+	{
+		if ( par->count ) par->func( par, 0, par->count );
+		return;
+	}
+
+	par->next = 0;
+	workers = __hashmap_alloc( sizeof(thread_t) * threads );
+
+	for ( i = 1; i < threads; i++ )
+		workers[i] = thread_create( __hashmap_parallel_worker, par );
+
+	__hashmap_parallel_worker( par );
+
+	for ( i = 1; i < threads; i++ )
+		thread_join( workers[i] );
+
+	__hashmap_free( workers );
+}
+
+/*
+ * __hashmap_clear_range - Release the entries of a range of buckets (or slots).
+ * @arg par: The parallel clear
+ * @arg first: First bucket of the range
+ * @arg last: One past the last bucket of the range
+ */
+static void __hashmap_clear_range( hashpar_t* par, uint32 first, uint32 last )
+{
+	hashmap_t* map = par->map;
+	hashnode_t* node;
+	hashslot_t* entry;
+	uint32 i;
+
+	// The nodes themselves are released with the slab, so the chains only
+	// need to be walked for destructors and keys living outside the arena.
+	if ( __hashmap_clear_needs_walk( map ) )
+	{
+		for ( i = first; i < last; i++ )
+		{
+			if ( par->nodes )
+			{
+				for ( node = par->nodes[i]; node; node = node->next )
+				{
+					if ( map->data_destroy )
+						map->data_destroy( node->data );
+
+					__hashmap_key_clear( map, node->key );
+				}
+			}
+			else if ( !( map->ctrl[i] & 0x80 ) )
+			{
+				entry = __hashmap_flat_entry( map, i );
+
+				if ( map->data_destroy )
+					map->data_destroy( entry->data );
+
+				__hashmap_key_clear( map, entry->key );
+			}
+		}
+	}
+
+	if ( par->nodes )
+		memset( &par->nodes[first], 0, sizeof(hashnode_t*) * ( last - first ) );
+	else
+		memset( &map->ctrl[first], HASHMAP_CTRL_EMPTY, last - first );
+}
+
+/*
+ * __hashmap_flat_clear - hashmap_clear for the flat and dense engines.
+ * @arg map: The hash map to be cleared
+ * @arg threads: Number of threads to clear the slots with
+ */
+static void __hashmap_flat_clear( hashmap_t* map, uint32 threads )
+{
+	hashpar_t par;
+
+	par.map = map;
+	par.nodes = NULL;
+	par.buckets = map->bucket_count;
+	par.count = map->bucket_count;
+	par.func = __hashmap_clear_range;
+
+	__hashmap_parallel_run( &par, threads );
+
+	map->tombstones = 0;
+	map->entry_count = 0;
+}
+
+/*
+ * __hashmap_tree_free - Destructor of the tree nodes of a treeified bucket.
+ * @arg node: The hashtree_t to be freed
+ */
+static void __hashmap_tree_free( void* node )
+{
+	__hashmap_free( node );
+}
+
+/*
+ * __hashmap_trees_free - Turn every treeified bucket back into a plain chain.
+ * The chains themselves are left untouched, only the trees are released.
+ * @arg map: Hashmap
+ * @returns: -
+ */
+static void __hashmap_trees_free( hashmap_t* map )
+{
+	uint32 i;
+
+	if ( !map->trees ) return;
+
+	for ( i = 0; i < map->bucket_count; i++ )
+	{
+		if ( map->trees[i] )
+			tree_destroy( map->trees[i] );
+	}
+
+	__hashmap_free( map->trees );
+	map->trees = NULL;
+}
+
+/*
+ * __hashmap_tree_link - Link a node into a treeified bucket. A node joins the group
+ * of its hash if there is one, otherwise it starts a new group at the head of the chain.
+ * @arg tree: Tree of the bucket
+ * @arg head: Head of the bucket
+ * @arg node: The node to be linked
+ * @returns: -
+ */
+static void __hashmap_tree_link( tree_t* tree, hashnode_t** head, hashnode_t* node )
+{
+	hashtree_t* group;
+
+	group = (hashtree_t*)tree_find( tree, node->hash );
+
+	if ( group )
+	{
+		node->next = *group->link;
+		*group->link = node;
+		return;
+	}
+
+	// The group that used to be first now follows the new node.
+	if ( *head )
+		( (hashtree_t*)tree_find( tree, (*head)->hash ) )->link = &node->next;
+
+	node->next = *head;
+	*head = node;
+
+	group = __hashmap_alloc( sizeof(*group) );
+	group->link = head;
+
+	tree_insert( tree, node->hash, &group->node );
+}
+
+/*
+ * __hashmap_treeify - Turn the chain of a bucket into a tree keyed on the full hash,
+ * so finding a key takes O(log n) steps instead of a walk over the whole chain.
+ * The nodes are regrouped so the ones sharing a hash are next to each other.
+ * @arg map: Hashmap
+ * @arg bucket: The bucket to be treeified
+ * @returns: -
+ */
+static void __hashmap_treeify( hashmap_t* map, uint32 bucket )
+{
+	hashnode_t *node, *next;
+	tree_t* tree;
+
+	assert( map->old_nodes == NULL );
+
+	if ( !map->trees )
+	{
+		map->trees = __hashmap_alloc( sizeof(tree_t*) * map->bucket_count );
+		memset( map->trees, 0, sizeof(tree_t*) * map->bucket_count );
+	}
+
+	tree = tree_create( __hashmap_tree_free );
+	map->trees[bucket] = tree;
+
+	node = map->nodes[bucket];
+	map->nodes[bucket] = NULL;
+
+	for ( ; node; node = next )
+	{
+		next = node->next;
+
+		__hashmap_tree_link( tree, &map->nodes[bucket], node );
+	}
+}
+
+/*
+ * __hashmap_tree_unlink - Update the tree of a bucket after a node was unlinked from its chain.
+ * The tree is released once the chain has become short enough to be walked again.
+ * @arg map: Hashmap
+ * @arg bucket: The treeified bucket
+ * @arg link: The link that pointed to the node
+ * @arg node: The unlinked node
+ * @returns: -
+ */
+static void __hashmap_tree_unlink( hashmap_t* map, uint32 bucket, hashnode_t** link, hashnode_t* node )
+{
+	tree_t* tree;
+	hashnode_t* next;
+	hashtree_t* group;
+	uint32 length;
+
+	tree = map->trees[bucket];
+	next = *link;
+
+	// Nothing moves unless the node was the last one of its group.
+	if ( next && next->hash == node->hash ) return;
+
+	if ( next )
+		( (hashtree_t*)tree_find( tree, next->hash ) )->link = link;
+
+	group = (hashtree_t*)tree_find( tree, node->hash );
+
+	if ( group->link == link )
+		tree_remove( tree, node->hash );
+
+	if ( tree->size >= HASHMAP_UNTREEIFY_THRESHOLD ) return;
+
+	for ( length = 0, next = map->nodes[bucket]; next && length < HASHMAP_UNTREEIFY_THRESHOLD; next = next->next )
+		length++;
+
+	if ( length < HASHMAP_UNTREEIFY_THRESHOLD )
+	{
+		tree_destroy( tree );
+		map->trees[bucket] = NULL;
+	}
+}
+
+/*
+ * __hashmap_tree_find_link - Find the link pointing to the node holding a key in a treeified bucket.
+ * @arg map: Hashmap
+ * @arg tree: Tree of the bucket
+ * @arg k: The key
+ * @returns: Pointer to the link, NULL if the key wasn't found
+ */
+static hashnode_t** __hashmap_tree_find_link( hashmap_t* map, tree_t* tree, const hashkey_t* k )
+{
+	hashtree_t* group;
+	hashnode_t** link;
+	HASHMAP_STAT( uint32 probes = 1 );
+
+	group = (hashtree_t*)tree_find( tree, k->hash );
+
+	if ( group )
+	{
+		// Only keys with a colliding full hash have to be compared one by one.
+		for ( link = group->link; *link && (*link)->hash == k->hash; link = &(*link)->next )
+		{
+			HASHMAP_STAT( probes++ );
+
+			if ( __hashmap_key_matches( map, k, (*link)->hash, (*link)->key, (*link)->ikey ) )
+			{
+				HASHMAP_STAT( __hashmap_stats_lookup( map, probes ) );
+				return link;
+			}
+		}
+	}
+
+	HASHMAP_STAT( __hashmap_stats_lookup( map, probes ) );
+
+	return NULL;
+}
+
+/*
+ * __hashmap_rehash_insert - A helper func to insert rehashed
+ * nodes back into the hashmap. The hash stored in the node is
+ * reused so the key is never hashed again.
+ * @arg map: The hashmap that was rehashed.
+ * @arg node: The node to be re-inserted
+ * @returns: -
+ */
+static void __hashmap_rehash_insert( hashmap_t* map, hashnode_t* node )
+{
+	uint32 hash;
+	hashnode_t* bucket;
+	
+	hash = node->hash & ( map->bucket_count - 1 );
+	bucket = map->nodes[hash];
+
+	if ( !bucket )
+		node->next = NULL;
+	else
+		node->next = bucket;
+	
+	map->nodes[hash] = node;
+}
+
+/*
+ * __hashmap_rehash_step - Migrate a bounded number of buckets from the old
+ * bucket array of an incremental rehash into the new one. The old array is
+ * released once every bucket has been moved.
+ * @arg map: The hashmap being rehashed
+ * @arg steps: Maximum number of non-empty buckets to migrate
+ * @returns: -
+ */
+static void __hashmap_rehash_step( hashmap_t* map, uint32 steps )
+{
+	hashnode_t *node, *next;
+	uint32 empty_visits;
+	HASHMAP_STAT( uint64 start = __hashmap_usecs() );
+
+	// Don't let a long run of empty buckets turn a single step into a full scan.
+	empty_visits = steps * 10;
+
+	while ( steps && map->rehash_index < map->old_bucket_count )
+	{
+		node = map->old_nodes[map->rehash_index];
+
+		if ( !node )
+		{
+			map->rehash_index++;
+
+			if ( --empty_visits == 0 ) break;
+			continue;
+		}
+
+		for ( ; node; node = next )
+		{
+			next = node->next;
+
+			__hashmap_rehash_insert( map, node );
+		}
+
+		map->old_nodes[map->rehash_index++] = NULL;
+		steps--;
+	}
+
+	if ( map->rehash_index >= map->old_bucket_count )
+	{
+		__hashmap_free( map->old_nodes );
+
+		map->old_nodes = NULL;
+		map->old_bucket_count = 0;
+		map->rehash_index = 0;
+	}
+
+	HASHMAP_STAT( map->counters.rehash_usecs += __hashmap_usecs() - start );
+}
+
+/*
+ * __hashmap_rehash_begin - Start an incremental rehash. A new bucket array is
+ * allocated but the nodes are left in the old one until rehash steps move them.
+ * @arg map: The hashmap to be rehashed
+ * @arg buckets: How many buckets the rehashed map should have, a power of two
+ * @returns: -
+ */
+static void __hashmap_rehash_begin( hashmap_t* map, uint32 buckets )
+{
+	assert( map->old_nodes == NULL );
+
+	HASHMAP_STAT( map->counters.rehashes++ );
+
+	__hashmap_trees_free( map );
+
+	map->old_nodes = map->nodes;
+	map->old_bucket_count = map->bucket_count;
+	map->rehash_index = 0;
+
+	map->nodes = __hashmap_alloc( sizeof(hashnode_t*) * buckets );
+	map->bucket_count = buckets;
+
+	memset( map->nodes, 0, sizeof(hashnode_t*) * buckets );
+
+	map->load_factor = (float)map->size / map->bucket_count;
+}
+
+/*
+ * __hashmap_find_link - Find the link pointing to the node holding a key.
+ * During an incremental rehash both bucket arrays are searched.
+ * @arg map: Hashmap
+ * @arg k: The key
+ * @returns: Pointer to the link (a bucket head or a next pointer), NULL if the key wasn't found
+ */
+static hashnode_t** __hashmap_find_link( hashmap_t* map, const hashkey_t* k )
+{
+	hashnode_t** link;
+	uint32 bucket;
+	HASHMAP_STAT( uint32 probes = 0 );
+
+	if ( map->old_nodes )
+	{
+		bucket = k->hash & ( map->old_bucket_count - 1 );
+
+		// Buckets below the rehash index have been migrated already.
+		if ( bucket >= map->rehash_index )
+		{
+			for ( link = &map->old_nodes[bucket]; *link; link = &(*link)->next )
+			{
+				HASHMAP_STAT( probes++ );
+
+				if ( __hashmap_key_matches( map, k, (*link)->hash, (*link)->key, (*link)->ikey ) )
+				{
+					HASHMAP_STAT( __hashmap_stats_lookup( map, probes ) );
+					return link;
+				}
+			}
+		}
+	}
+
+	bucket = k->hash & ( map->bucket_count - 1 );
+
+	if ( map->trees && map->trees[bucket] )
+		return __hashmap_tree_find_link( map, map->trees[bucket], k );
+
+	for ( link = &map->nodes[bucket]; *link; link = &(*link)->next )
+	{
+		HASHMAP_STAT( probes++ );
+
+		if ( __hashmap_key_matches( map, k, (*link)->hash, (*link)->key, (*link)->ikey ) )
+		{
+			HASHMAP_STAT( __hashmap_stats_lookup( map, probes ) );
+			return link;
+		}
+	}
+
+	HASHMAP_STAT( __hashmap_stats_lookup( map, probes ) );
+
+	return NULL;
+}
+
+/*
+ * __hashmap_frozen_hash - Hash a key of a frozen snapshot. Unlike the hashes of
+ * the other engines this one is seeded and 64 bits wide, so a seed that gives
+ * every key of the snapshot a distinct position is easy to find.
+ * @arg map: The frozen map, or the map being frozen
+ * @arg k: The resolved key, its hash is not used
+ * @arg seed: Seed of the snapshot
+ * @returns: Calculated hash
+ */
+static MYLLY_INLINE uint64 __hashmap_frozen_hash( hashmap_t* map, const hashkey_t* k, uint64 seed )
+{
+	if ( HASHMAP_INLINE_KEYS( map ) )
+		return __hashmap_fmix64( k->value ^ seed );
+
+	if ( k->len != HASHMAP_NO_LEN )
+		return __hashmap_wyhash( k->ptr, k->len, seed );
+
+	return __hashmap_wyhash( k->ptr, map->key_size( k->ptr ), seed );
+}
+
+/*
+ * __hashmap_reduce - Map a 32 bit hash to a range without a division.
+ * @arg hash: The hash
+ * @arg range: Size of the range
+ * @returns: Value between 0 and range - 1
+ */
+static MYLLY_INLINE uint32 __hashmap_reduce( uint32 hash, uint32 range )
+{
+	return (uint32)( ( (uint64)hash * range ) >> 32 );
+}
+
+/*
+ * __hashmap_frozen_pos - Calculate the position of a key in a frozen snapshot.
+ * @arg hash: Frozen hash of the key
+ * @arg count: Number of slots in the snapshot
+ * @arg buckets: Number of displacement buckets in the snapshot
+ * @arg pos: The calculated position
+ */
+static MYLLY_INLINE void __hashmap_frozen_pos( uint64 hash, uint32 count, uint32 buckets, hashfrozen_pos_t* pos )
+{
+	pos->bucket = __hashmap_reduce( (uint32)( hash >> 32 ), buckets );
+	pos->f1 = __hashmap_reduce( (uint32)hash, count );
+	pos->f2 = __hashmap_reduce( (uint32)__hashmap_fmix64( hash ), count );
+}
+
+/*
+ * __hashmap_frozen_slot - Get the slot of a key displaced by a displacement pair.
+ * @arg pos: Position of the key
+ * @arg d0: First displacement, multiplies the slot step
+ * @arg d1: Second displacement, added to the slot
+ * @arg count: Number of slots in the snapshot
+ * @returns: Index of the slot
+ */
+static MYLLY_INLINE uint32 __hashmap_frozen_slot( const hashfrozen_pos_t* pos, uint32 d0, uint32 d1, uint32 count )
+{
+	return (uint32)( ( pos->f1 + (uint64)d0 * pos->f2 + d1 ) % count );
+}
+
+/*
+ * __hashmap_frozen_lookup - Find the only slot a key can be in within a frozen map.
+ * @arg map: A non-empty frozen map
+ * @arg k: The resolved key
+ * @returns: Pointer to the slot
+ */
+static MYLLY_INLINE const hashfrozen_slot_t* __hashmap_frozen_lookup( hashmap_t* map, const hashkey_t* k )
+{
+	const hashfrozen_t* frozen = map->frozen;
+	const hashfrozen_slot_t* slots;
+	const uint32* displace;
+	hashfrozen_pos_t pos;
+
+	__hashmap_frozen_pos( __hashmap_frozen_hash( map, k, frozen->seed ), frozen->count, frozen->bucket_count, &pos );
+
+	displace = HASHMAP_FROZEN_AT( frozen, frozen->displace );
+	slots = HASHMAP_FROZEN_AT( frozen, frozen->slots );
+
+	return &slots[__hashmap_frozen_slot( &pos, displace[2 * pos.bucket], displace[2 * pos.bucket + 1], frozen->count )];
+}
+
+/*
+ * __hashmap_frozen_data - Get the data stored in a slot of a frozen snapshot.
+ * @arg frozen: The snapshot
+ * @arg slot: The slot
+ * @returns: The data pointer, or the address of the data copied into the snapshot
+ */
+static MYLLY_INLINE void* __hashmap_frozen_data( const hashfrozen_t* frozen, const hashfrozen_slot_t* slot )
+{
+	if ( frozen->values )
+		return (void*)HASHMAP_FROZEN_AT( frozen, slot->data );
+
+	return (void*)(size_t)slot->data;
+}
+
+/*
+ * __hashmap_frozen_match - Check whether a slot of a frozen map holds a key.
+ * @arg map: Frozen map
+ * @arg slot: The slot returned by __hashmap_frozen_lookup
+ * @arg k: The resolved key
+ * @returns: Data stored with the key, NULL if the key isn't in the map
+ */
+static MYLLY_INLINE void* __hashmap_frozen_match( hashmap_t* map, const hashfrozen_slot_t* slot, const hashkey_t* k )
+{
+	const void* key;
+
+	if ( HASHMAP_INLINE_KEYS( map ) )
+	{
+		if ( slot->key != k->value ) return NULL;
+	}
+	else
+	{
+		HASHMAP_STAT( map->counters.key_compares++ );
+
+		key = HASHMAP_FROZEN_AT( map->frozen, slot->key );
+
+		if ( k->len != HASHMAP_NO_LEN ? !__hashmap_string_matches( key, k ) : !map->key_equals( k->ptr, key ) )
+			return NULL;
+	}
+
+	return __hashmap_frozen_data( map->frozen, slot );
+}
+
+/*
+ * __hashmap_frozen_find - hashmap_find for the frozen engine. Every key has
+ * exactly one slot it can be in, so the lookup is a single probe.
+ * @arg map: Frozen map
+ * @arg k: The resolved key, its hash is not used
+ * @returns: Found data, or NULL if no data was found
+ */
+static void* __hashmap_frozen_find( hashmap_t* map, const hashkey_t* k )
+{
+	HASHMAP_STAT( __hashmap_stats_lookup( map, map->size ? 1 : 0 ) );
+
+	if ( map->size == 0 ) return NULL;
+
+	return __hashmap_frozen_match( map, __hashmap_frozen_lookup( map, k ), k );
+}
+
+/*
+ * __hashmap_insert - Insert a resolved key and its data to the table.
+ * @arg map: Hashmap.
+ * @arg k: The key.
+ * @arg data: The data to be stored.
+ * @returns: Previous data assigned to this key, NULL if nothing was stored
+ */
+static void* __hashmap_insert( hashmap_t* map, const hashkey_t* k, const void* data )
+{
+	hashnode_t **link, *newnode, *node;
+	void* old;
+	uint32 bucket, length;
+
+	assert( map->engine != HASHMAP_FROZEN ); // Frozen maps are read-only
+
+	if ( HASHMAP_OPEN_ADDRESSING( map ) )
+		return __hashmap_flat_insert( map, k, data );
+
+	assert( map->nodes != NULL );
+
+	if ( map->old_nodes )
+		__hashmap_rehash_step( map, map->rehash_step );
+
+	// A key the filter rejects is new, there's no need to look for it.
+	link = __hashmap_filter_rejects( map, k->hash ) ? NULL : __hashmap_find_link( map, k );
+
+	if ( link )
+	{
+		old = (void*)(*link)->data;
+		(*link)->data = data;
+
+		if ( map->data_destroy )
+		{
+			map->data_destroy( old );
+			return NULL;
+		}
+
+		return old;
+	}
+
+	bucket = k->hash & ( map->bucket_count - 1 );
+
+	newnode = __hashmap_node_create( map, k, data );
+
+	if ( map->trees && map->trees[bucket] )
+	{
+		__hashmap_tree_link( map->trees[bucket], &map->nodes[bucket], newnode );
+	}
+	else
+	{
+		newnode->next = map->nodes[bucket];
+		map->nodes[bucket] = newnode;
+
+		// Chains only grow here, so this is the only place a bucket is treeified and
+		// lookups never modify the map. Buckets aren't treeified during an incremental
+		// rehash, the trees would only have to be rebuilt when the nodes are migrated.
+		if ( !map->old_nodes )
+		{
+			for ( length = 0, node = newnode; node && length <= HASHMAP_TREEIFY_THRESHOLD; node = node->next )
+				length++;
+
+			if ( length > HASHMAP_TREEIFY_THRESHOLD )
+				__hashmap_treeify( map, bucket );
+		}
+	}
+
+	if ( map->filter )
+		__hashmap_filter_inserted( map, k->hash );
+	
+	if ( map->load_factor > map->max_load_factor && !map->old_nodes )
+	{
+		if ( map->rehash_step )
+			__hashmap_rehash_begin( map, HASHMAP_EXPANSION_FACTOR * map->bucket_count );
+		else
+			hashmap_rehash( map, HASHMAP_EXPANSION_FACTOR * map->bucket_count );
+	}
+
+	return NULL;
+}
+
+/*
+ * __hashmap_erase - Remove a resolved key and its data from the table.
+ * @arg map: The hashmap to remove from.
+ * @arg k: The key.
+ * @returns: Removed data, NULL if nothing was stored or a destructor was called
+ */
+static void* __hashmap_erase( hashmap_t* map, const hashkey_t* k )
+{
+	hashnode_t **link, *node;
+	void* data;
+	uint32 bucket;
+
+	assert( map->engine != HASHMAP_FROZEN ); // Frozen maps are read-only
+
+	if ( __hashmap_filter_rejects( map, k->hash ) ) return NULL;
+
+	if ( HASHMAP_OPEN_ADDRESSING( map ) )
+		return __hashmap_flat_erase( map, k );
+
+	assert( map->nodes != NULL );
+
+	if ( map->old_nodes )
+		__hashmap_rehash_step( map, map->rehash_step );
+
+	link = __hashmap_find_link( map, k );
+	if ( !link ) return NULL;
+
+	node = *link;
+	*link = node->next;
+
+	bucket = node->hash & ( map->bucket_count - 1 );
+
+	if ( map->trees && map->trees[bucket] )
+		__hashmap_tree_unlink( map, bucket, link, node );
+
+	data = (void*)node->data;
+
+	if ( node->key != HASHMAP_NODE_KEY( node ) )
+		__hashmap_key_release( map, node->key );
+
+	__hashmap_node_release( map, node );
+
+	map->size--;
+	map->load_factor = (float)map->size / map->bucket_count;
+
+	if ( map->filter )
+		__hashmap_filter_erased( map );
+
+	if ( map->data_destroy )
+	{
+		map->data_destroy( data );
+		return NULL;
+	}
+
+	return data;
+}
+
+/*
+ * __hashmap_find - Find the data matching a resolved key.
+ * @arg map: Hashmap to look from
+ * @arg k: The key
+ * @returns: Found data, or NULL if no data was found.
+ */
+static void* __hashmap_find( hashmap_t* map, const hashkey_t* k )
+{
+	hashnode_t** link;
+	uint32 slot;
+
+	if ( __hashmap_filter_rejects( map, k->hash ) ) return NULL;
+
+	if ( HASHMAP_OPEN_ADDRESSING( map ) )
+	{
+		slot = __hashmap_flat_find_slot( map, k );
+		return slot != map->bucket_count ? (void*)__hashmap_flat_entry( map, slot )->data : NULL;
+	}
+
+	assert( map->nodes != NULL );
+
+	if ( map->old_nodes )
+		__hashmap_rehash_step( map, map->rehash_step );
+
+	link = __hashmap_find_link( map, k );
+
+	return link ? (void*)(*link)->data : NULL;
+}
+
+/*
+ * hashmap_insert - Insert a new key-data pair to the table.
+ * If a key exists already, the previous data will be overwritten.
+ * @arg map: Hashmap.
+ * @arg key: Pointer to the key value. For pointer keys the pointer itself.
+ * @arg data: The data to be stored.
+ * @returns: Previous data assigned to this key, NULL if nothing was stored
+ */
+void* hashmap_insert( hashmap_t* map, const void* key, const void* data )
+{
+	hashkey_t k;
+
+	assert( map != NULL );
+
+	__hashmap_make_key( map, key, &k );
+
+	return __hashmap_insert( map, &k, data );
+}
+
+/*
+ * hashmap_erase - Remove a key-data pair from the table.
+ * @arg map: The hashmap to remove from.
+ * @arg key: Pointer to the key value. For pointer keys the pointer itself.
+ * @returns: Removed data, NULL if nothing was stored or a destructor was called
+ */
+void* hashmap_erase( hashmap_t* map, const void* key )
+{
+	hashkey_t k;
+
+	assert( map != NULL );
+
+	__hashmap_make_key( map, key, &k );
+
+	return __hashmap_erase( map, &k );
+}
+
+/*
+ * hashmap_find - Find a data pointer matching the given key.
+ * @arg map: Hashmap to look from
+ * @arg key: The key. For pointer keys the pointer itself.
+ * @returns: Found data, or NULL if no data was found.
+ */
+void* hashmap_find( hashmap_t* map, const void* key )
+{
+	hashkey_t k;
+
+	assert( map != NULL );
+
+	// Frozen maps hash the keys differently.
+	if ( map->engine == HASHMAP_FROZEN )
+	{
+		__hashmap_resolve_key( map, key, &k );
+		return __hashmap_frozen_find( map, &k );
+	}
+
+	__hashmap_make_key( map, key, &k );
+
+	return __hashmap_find( map, &k );
+}
+
+/*
+ * hashmap_insert_int - Insert a new key-data pair to a map with integer or pointer keys.
+ * @arg map: Hashmap created with HASHMAP_KEY_UINT32, HASHMAP_KEY_UINT64 or HASHMAP_KEY_POINTER.
+ * @arg key: The key value.
+ * @arg data: The data to be stored.
+ * @returns: Previous data assigned to this key, NULL if nothing was stored
+ */
+void* hashmap_insert_int( hashmap_t* map, uint64 key, const void* data )
+{
+	hashkey_t k;
+
+	assert( map != NULL );
+
+	__hashmap_make_int_key( map, key, &k );
+
+	return __hashmap_insert( map, &k, data );
+}
+
+/*
+ * hashmap_erase_int - Remove a key-data pair from a map with integer or pointer keys.
+ * @arg map: The hashmap to remove from.
+ * @arg key: The key value.
+ * @returns: Removed data, NULL if nothing was stored or a destructor was called
+ */
+void* hashmap_erase_int( hashmap_t* map, uint64 key )
+{
+	hashkey_t k;
+
+	assert( map != NULL );
+
+	__hashmap_make_int_key( map, key, &k );
+
+	return __hashmap_erase( map, &k );
+}
+
+/*
+ * hashmap_find_int - Find a data pointer in a map with integer or pointer keys.
+ * @arg map: Hashmap to look from
+ * @arg key: The key value.
+ * @returns: Found data, or NULL if no data was found.
+ */
+void* hashmap_find_int( hashmap_t* map, uint64 key )
+{
+	hashkey_t k;
+
+	assert( map != NULL );
+
+	__hashmap_make_int_key( map, key, &k );
+
+	if ( map->engine == HASHMAP_FROZEN )
+		return __hashmap_frozen_find( map, &k );
+
+	return __hashmap_find( map, &k );
+}
+
+/*
+ * hashmap_insert_n - Insert a string key given as a pointer and a length, such as
+ * a slice of a larger buffer. The map stores a NUL-terminated copy of the key.
+ * @arg map: Hashmap using the default string key functions
+ * @arg key: The characters of the key, need not be NUL-terminated but must not contain NULs
+ * @arg len: Number of characters in the key
+ * @arg data: The data to be stored.
+ * @returns: Previous data assigned to this key, NULL if nothing was stored
+ */
+void* hashmap_insert_n( hashmap_t* map, const char* key, size_t len, const void* data )
+{
+	hashkey_t k;
+
+	assert( map != NULL );
+
+	__hashmap_make_key_n( map, key, len, &k );
+
+	return __hashmap_insert( map, &k, data );
+}
+
+/*
+ * hashmap_erase_n - Remove a string key given as a pointer and a length.
+ * @arg map: Hashmap using the default string key functions
+ * @arg key: The characters of the key, need not be NUL-terminated but must not contain NULs
+ * @arg len: Number of characters in the key
+ * @returns: Removed data, NULL if nothing was stored or a destructor was called
+ */
+void* hashmap_erase_n( hashmap_t* map, const char* key, size_t len )
+{
+	hashkey_t k;
+
+	assert( map != NULL );
+
+	__hashmap_make_key_n( map, key, len, &k );
+
+	return __hashmap_erase( map, &k );
+}
+
+/*
+ * hashmap_find_n - Find a string key given as a pointer and a length.
+ * @arg map: Hashmap using the default string key functions
+ * @arg key: The characters of the key, need not be NUL-terminated but must not contain NULs
+ * @arg len: Number of characters in the key
+ * @returns: Found data, or NULL if no data was found.
+ */
+void* hashmap_find_n( hashmap_t* map, const char* key, size_t len )
+{
+	hashkey_t k;
+
+	assert( map != NULL );
+
+	if ( map->engine == HASHMAP_FROZEN )
+	{
+		assert( HASHMAP_STRING_KEYS( map ) );
+
+		k.ptr = key;
+		k.value = 0;
+		k.len = len;
+
+		return __hashmap_frozen_find( map, &k );
+	}
+
+	__hashmap_make_key_n( map, key, len, &k );
+
+	return __hashmap_find( map, &k );
+}
+
+/*
+ * hashmap_hash_key - Calculate the hash of a key, to be passed to the _h functions.
+ * The hash is the same for every map with the same key type and key functions.
+ * @arg map: Hashmap
+ * @arg key: The key. For pointer keys the pointer itself.
+ * @returns: Hash of the key
+ */
+uint32 hashmap_hash_key( hashmap_t* map, const void* key )
+{
+	hashkey_t k;
+
+	assert( map != NULL );
+
+	__hashmap_make_key( map, key, &k );
+
+	return k.hash;
+}
+
+/*
+ * hashmap_hash_key_n - Calculate the hash of a string key given as a pointer and a length.
+ * The hash equals the hash of the same key NUL-terminated.
+ * @arg map: Hashmap using the default string key functions
+ * @arg key: The characters of the key
+ * @arg len: Number of characters in the key
+ * @returns: Hash of the key
+ */
+uint32 hashmap_hash_key_n( hashmap_t* map, const char* key, size_t len )
+{
+	hashkey_t k;
+
+	assert( map != NULL );
+
+	__hashmap_make_key_n( map, key, len, &k );
+
+	return k.hash;
+}
+
+/*
+ * __hashmap_make_key_h - Resolve a key passed with a precomputed hash. The length of
+ * a string key is not measured, the key is compared with key_equals and only measured
+ * by key_size when a new key is stored.
+ * @arg map: Hashmap
+ * @arg key: The key as passed by the caller
+ * @arg hash: Hash of the key from hashmap_hash_key
+ * @arg out: The resolved key
+ */
+static MYLLY_INLINE void __hashmap_make_key_h( hashmap_t* map, const void* key, uint32 hash, hashkey_t* out )
+{
+	out->ptr = key;
+	out->value = __hashmap_key_value( map, key );
+	out->len = HASHMAP_NO_LEN;
+	out->hash = hash;
+}
+
+/*
+ * hashmap_insert_h - Insert a new key-data pair using a precomputed hash.
+ * @arg map: Hashmap.
+ * @arg key: Pointer to the key value. For pointer keys the pointer itself.
+ * @arg hash: Hash of the key from hashmap_hash_key or hashmap_hash_key_n
+ * @arg data: The data to be stored.
+ * @returns: Previous data assigned to this key, NULL if nothing was stored
+ */
+void* hashmap_insert_h( hashmap_t* map, const void* key, uint32 hash, const void* data )
+{
+	hashkey_t k;
+
+	assert( map != NULL );
+
+	__hashmap_make_key_h( map, key, hash, &k );
+
+	return __hashmap_insert( map, &k, data );
+}
+
+/*
+ * hashmap_erase_h - Remove a key-data pair using a precomputed hash.
+ * @arg map: The hashmap to remove from.
+ * @arg key: Pointer to the key value. For pointer keys the pointer itself.
+ * @arg hash: Hash of the key from hashmap_hash_key or hashmap_hash_key_n
+ * @returns: Removed data, NULL if nothing was stored or a destructor was called
+ */
+void* hashmap_erase_h( hashmap_t* map, const void* key, uint32 hash )
+{
+	hashkey_t k;
+
+	assert( map != NULL );
+
+	__hashmap_make_key_h( map, key, hash, &k );
+
+	return __hashmap_erase( map, &k );
+}
+
+/*
+ * hashmap_find_h - Find a data pointer using a precomputed hash.
+ * Frozen maps hash their keys differently and ignore the hash.
+ * @arg map: Hashmap to look from
+ * @arg key: The key. For pointer keys the pointer itself.
+ * @arg hash: Hash of the key from hashmap_hash_key or hashmap_hash_key_n
+ * @returns: Found data, or NULL if no data was found.
+ */
+void* hashmap_find_h( hashmap_t* map, const void* key, uint32 hash )
+{
+	hashkey_t k;
+
+	assert( map != NULL );
+
+	if ( map->engine == HASHMAP_FROZEN )
+	{
+		__hashmap_resolve_key( map, key, &k );
+		return __hashmap_frozen_find( map, &k );
+	}
+
+	__hashmap_make_key_h( map, key, hash, &k );
+
+	return __hashmap_find( map, &k );
+}
+
+/*
+ * __hashmap_make_key_nh - Resolve a string key given as a pointer and a length with a precomputed hash.
+ * @arg map: Hashmap using the default string key functions
+ * @arg key: The characters of the key, not necessarily NUL-terminated
+ * @arg len: Number of characters in the key
+ * @arg hash: Hash of the key from hashmap_hash_key or hashmap_hash_key_n
+ * @arg out: The resolved key
+ */
+static MYLLY_INLINE void __hashmap_make_key_nh( hashmap_t* map, const char* key, size_t len, uint32 hash, hashkey_t* out )
+{
+	assert( HASHMAP_STRING_KEYS( map ) );
+	UNREFERENCED_PARAM(map);
+
+	out->ptr = key;
+	out->value = 0;
+	out->len = len;
+	out->hash = hash;
+}
+
+/*
+ * hashmap_insert_nh - Insert a string key given as a pointer and a length using a precomputed hash.
+ * @arg map: Hashmap using the default string key functions
+ * @arg key: The characters of the key, need not be NUL-terminated but must not contain NULs
+ * @arg len: Number of characters in the key
+ * @arg hash: Hash of the key from hashmap_hash_key or hashmap_hash_key_n
+ * @arg data: The data to be stored.
+ * @returns: Previous data assigned to this key, NULL if nothing was stored
+ */
+void* hashmap_insert_nh( hashmap_t* map, const char* key, size_t len, uint32 hash, const void* data )
+{
+	hashkey_t k;
+
+	assert( map != NULL );
+
+	__hashmap_make_key_nh( map, key, len, hash, &k );
+
+	return __hashmap_insert( map, &k, data );
+}
+
+/*
+ * hashmap_erase_nh - Remove a string key given as a pointer and a length using a precomputed hash.
+ * @arg map: Hashmap using the default string key functions
+ * @arg key: The characters of the key, need not be NUL-terminated but must not contain NULs
+ * @arg len: Number of characters in the key
+ * @arg hash: Hash of the key from hashmap_hash_key or hashmap_hash_key_n
+ * @returns: Removed data, NULL if nothing was stored or a destructor was called
+ */
+void* hashmap_erase_nh( hashmap_t* map, const char* key, size_t len, uint32 hash )
+{
+	hashkey_t k;
+
+	assert( map != NULL );
+
+	__hashmap_make_key_nh( map, key, len, hash, &k );
+
+	return __hashmap_erase( map, &k );
+}
+
+/*
+ * hashmap_find_nh - Find a string key given as a pointer and a length using a precomputed hash.
+ * Frozen maps hash their keys differently and ignore the hash.
+ * @arg map: Hashmap using the default string key functions
+ * @arg key: The characters of the key, need not be NUL-terminated but must not contain NULs
+ * @arg len: Number of characters in the key
+ * @arg hash: Hash of the key from hashmap_hash_key or hashmap_hash_key_n
+ * @returns: Found data, or NULL if no data was found.
+ */
+void* hashmap_find_nh( hashmap_t* map, const char* key, size_t len, uint32 hash )
+{
+	hashkey_t k;
+
+	assert( map != NULL );
+
+	if ( map->engine == HASHMAP_FROZEN )
+		return hashmap_find_n( map, key, len );
+
+	__hashmap_make_key_nh( map, key, len, hash, &k );
+
+	return __hashmap_find( map, &k );
+}
+
+/*
+ * __hashmap_clear_buckets - Free every node of a bucket array.
+ * @arg map: The hash map to be cleared
+ * @arg nodes: The bucket array
+ * @arg buckets: Number of buckets in the array
+ * @arg threads: Number of threads to clear the buckets with
+ * @returns: -
+ */
+static void __hashmap_clear_buckets( hashmap_t* map, hashnode_t** nodes, uint32 buckets, uint32 threads )
+{
+	hashpar_t par;
+
+	par.map = map;
+	par.nodes = nodes;
+	par.buckets = buckets;
+	par.count = buckets;
+	par.func = __hashmap_clear_range;
+
+	__hashmap_parallel_run( &par, threads );
+}
+
+/*
+ * hashmap_clear - Remove all nodes from a hash table.
+ * @arg map: The hash map to be cleared
+ * @returns: -
+ */
+void hashmap_clear( hashmap_t* map )
+{
+	hashmap_clear_parallel( map, 1 );
+}
+
+/*
+ * hashmap_clear_parallel - Remove all nodes from a hash table, splitting the buckets
+ * between several threads. The data destructor and the key functions of the map are
+ * called from every thread at once, so they must be thread safe.
+ * @arg map: The hash map to be cleared
+ * @arg threads: Number of threads to use, 0 to use every CPU
+ * @returns: -
+ */
+void hashmap_clear_parallel( hashmap_t* map, uint32 threads )
+{
+	assert( map != NULL );
+	assert( map->engine != HASHMAP_FROZEN ); // Frozen maps are read-only
+
+	if ( HASHMAP_OPEN_ADDRESSING( map ) )
+	{
+		__hashmap_flat_clear( map, threads );
+	}
+	else
+	{
+		assert( map->nodes != NULL );
+
+		__hashmap_trees_free( map );
+		__hashmap_clear_buckets( map, map->nodes, map->bucket_count, threads );
+
+		if ( map->old_nodes )
+		{
+			__hashmap_clear_buckets( map, map->old_nodes, map->old_bucket_count, threads );
+			__hashmap_free( map->old_nodes );
+
+			map->old_nodes = NULL;
+			map->old_bucket_count = 0;
+			map->rehash_index = 0;
+		}
+	}
+
+	__hashmap_storage_reset( map );
+
+	if ( map->filter )
+	{
+		memset( map->filter, 0, map->filter_blocks * HASHMAP_FILTER_BLOCK );
+		map->filter_erased = 0;
+	}
+
+	map->size = 0;
+	map->load_factor = 0;
+}
+
+/*
+ * hashmap_rehash - Rehash the map and allocate extra space if needed.
+ * An incremental rehash in progress is completed first.
+ * @arg map: The hash map to be rehashed
+ * @arg buckets: How many buckets the rehashed map should have, rounded up to a power of two
+ * @returns: -
+ */
+void hashmap_rehash( hashmap_t* map, uint32 buckets )
+{
+	hashmap_rehash_parallel( map, buckets, 1 );
+}
+
+/*
+ * __hashmap_rehash_range - Move the nodes of a range of old buckets into the new
+ * bucket array. A work item is a residue class of the smaller of the two bucket
+ * counts: the old buckets of a class only ever move into new buckets of the same
+ * class, so the threads never link nodes into the same bucket.
+ * @arg par: The parallel rehash, nodes being the old bucket array
+ * @arg first: First residue class of the range
+ * @arg last: One past the last residue class of the range
+ */
+static void __hashmap_rehash_range( hashpar_t* par, uint32 first, uint32 last )
+{
+	hashnode_t *node, *next;
+	uint32 i, r;
+
+	for ( r = first; r < last; r++ )
+	{
+		for ( i = r; i < par->buckets; i += par->count )
+		{
+			for ( node = par->nodes[i]; node; node = next )
+			{
+				next = node->next;
+
+				__hashmap_rehash_insert( par->map, node );
+			}
+		}
+	}
+}
+
+/*
+ * hashmap_rehash_parallel - Rehash the map, splitting the buckets between several
+ * threads. The flat and dense engines rehash on the calling thread only.
+ * @arg map: The hash map to be rehashed
+ * @arg buckets: The new number of buckets (or slots)
+ * @arg threads: Number of threads to use, 0 to use every CPU
+ */
+void hashmap_rehash_parallel( hashmap_t* map, uint32 buckets, uint32 threads )
+{
+	hashpar_t par;
+	HASHMAP_STAT( uint64 start );
+
+	assert( map != NULL );
+	assert( map->engine != HASHMAP_FROZEN ); // Frozen maps are read-only
+
+	if ( buckets == 0 ) return;
+
+	if ( HASHMAP_OPEN_ADDRESSING( map ) )
+	{
+		__hashmap_flat_rehash( map, __hashmap_flat_capacity( map, buckets ) );
+		return;
+	}
+
+	assert( map->nodes != NULL );
+
+	while ( map->old_nodes )
+		__hashmap_rehash_step( map, map->old_bucket_count );
+
+	HASHMAP_STAT( start = __hashmap_usecs() );
+
+	buckets = __hashmap_pow2( buckets );
+
+	__hashmap_trees_free( map );
+
+	par.map = map;
+	par.nodes = map->nodes;
+	par.buckets = map->bucket_count;
+	par.count = buckets < par.buckets ? buckets : par.buckets;
+	par.func = __hashmap_rehash_range;
+
+	map->nodes = __hashmap_alloc( sizeof(hashnode_t*) * buckets );
+	map->bucket_count = buckets;
+
+	memset( map->nodes, 0, sizeof(hashnode_t*) * buckets );
+
+	__hashmap_parallel_run( &par, threads );
+
+	map->load_factor = (float)map->size / map->bucket_count;
+
+	__hashmap_free( par.nodes );
+
+	if ( map->filter )
+		__hashmap_filter_rebuild( map );
+
+	HASHMAP_STAT( map->counters.rehashes++ );
+	HASHMAP_STAT( map->counters.rehash_usecs += __hashmap_usecs() - start );
+}
+
+/*
+ * hashmap_reserve - Make room for a number of entries, so the map does not have
+ * to grow until it holds more of them.
+ * @arg map: Hashmap
+ * @arg count: Total number of entries the map should be able to hold
+ */
+void hashmap_reserve( hashmap_t* map, uint32 count )
+{
+	uint32 slots, nodes;
+
+	assert( map != NULL );
+	assert( map->engine != HASHMAP_FROZEN ); // Frozen maps are read-only
+
+	slots = (uint32)( count / map->max_load_factor ) + 1;
+
+	if ( HASHMAP_OPEN_ADDRESSING( map ) )
+	{
+		if ( (float)count > map->max_load_factor * map->bucket_count )
+			__hashmap_flat_rehash( map, __hashmap_flat_capacity( map, slots ) );
+
+		return;
+	}
+
+	if ( slots > map->bucket_count || map->old_nodes )
+		hashmap_rehash( map, slots > map->bucket_count ? slots : map->bucket_count );
+
+	// Allocate the rest of the nodes in as few slab blocks as possible.
+	if ( count > map->size )
+	{
+		nodes = __hashmap_pow2( count - map->size );
+		if ( nodes > HASHMAP_NODE_BLOCK_MAX ) nodes = HASHMAP_NODE_BLOCK_MAX;
+
+		if ( nodes > map->node_block_size )
+			map->node_block_size = nodes;
+	}
+}
+
+/*
+ * hashmap_shrink_to_fit - Shrink the buckets (or the slots) of a map to the
+ * smallest size its entries fit in. Erased slots of the flat engine and erased
+ * entries of the dense engine are reclaimed as well.
+ * @arg map: Hashmap
+ */
+void hashmap_shrink_to_fit( hashmap_t* map )
+{
+	uint32 buckets;
+
+	assert( map != NULL );
+	assert( map->engine != HASHMAP_FROZEN ); // Frozen maps are read-only
+
+	if ( HASHMAP_OPEN_ADDRESSING( map ) )
+	{
+		buckets = __hashmap_flat_capacity( map, 0 );
+
+		if ( buckets < map->bucket_count || map->tombstones || map->entry_count > map->size )
+			__hashmap_flat_rehash( map, buckets );
+
+		return;
+	}
+
+	buckets = __hashmap_pow2( (uint32)( map->size / map->max_load_factor ) + 1 );
+
+	if ( buckets < map->bucket_count || map->old_nodes )
+		hashmap_rehash( map, buckets );
+}
+
+/*
+ * hashmap_set_filter - Enable or disable a blocked Bloom filter in front of the map.
+ * Lookups and erases of keys the filter rejects return right away, without walking
+ * a chain or probing a slot group, and inserts of new keys skip looking for an
+ * existing entry. The filter grows with the map and is rebuilt when the map is
+ * rehashed or enough keys have been erased.
+ * @arg map: Hashmap
+ * @arg bits_per_key: Filter bits for each key, 0 to disable the filter. Around 10
+ * gives one false positive in a hundred lookups of missing keys.
+ */
+void hashmap_set_filter( hashmap_t* map, uint32 bits_per_key )
+{
+	assert( map != NULL );
+	assert( map->engine != HASHMAP_FROZEN ); // A frozen lookup takes a single probe anyway
+	assert( bits_per_key <= 64 );
+
+	map->filter_bits = bits_per_key;
+
+	if ( bits_per_key )
+		__hashmap_filter_rebuild( map );
+	else
+		__hashmap_filter_free( map );
+}
+
+/*
+ * hashmap_set_small_keys - Set the size of the keys stored in the nodes themselves.
+ * Keys up to this size are copied right after their node instead of the key arena,
+ * so a lookup doesn't have to fetch the key from another cache line. Only affects
+ * string keys and custom keys with a key_size function and the default key_dup, in
+ * maps using the chained engine.
+ * Can only be changed while the map is empty and has no nodes, e.g. after hashmap_clear.
+ * @arg map: Hashmap
+ * @arg size: Size of the largest key stored in a node in bytes, 0 to store every key separately
+ */
+void hashmap_set_small_keys( hashmap_t* map, uint32 size )
+{
+	assert( map != NULL );
+	assert( map->node_blocks == NULL );
+	assert( size <= HASHMAP_ARENA_CLASSES * HASHMAP_ARENA_ALIGN );
+
+	if ( map->engine != HASHMAP_CHAINED || HASHMAP_INLINE_KEYS( map ) )
+		return;
+
+	map->small_key_size = ( size + HASHMAP_ARENA_ALIGN - 1 ) & ~( HASHMAP_ARENA_ALIGN - 1 );
+}
+
+/*
+ * __hashmap_prefetch_buckets - Prefetch the buckets (or the control groups and
+ * slots) of a number of resolved keys.
+ * @arg map: Hashmap
+ * @arg keys: The resolved keys
+ * @arg count: Number of keys
+ */
+static void __hashmap_prefetch_buckets( hashmap_t* map, const hashkey_t* keys, uint32 count )
+{
+	uint32 i, slot;
+
+	if ( HASHMAP_OPEN_ADDRESSING( map ) )
+	{
+		for ( i = 0; i < count; i++ )
+		{
+			slot = ( ( __hashmap_flat_mix( keys[i].hash ) >> 7 ) * HASHMAP_GROUP_WIDTH ) & ( map->bucket_count - 1 );
+
+			HASHMAP_PREFETCH( &map->ctrl[slot] );
+
+			if ( map->engine == HASHMAP_DENSE )
+				HASHMAP_PREFETCH( &map->index[slot] );
+			else
+				HASHMAP_PREFETCH( &map->slots[slot] );
+		}
+
+		return;
+	}
+
+	for ( i = 0; i < count; i++ )
+		HASHMAP_PREFETCH( &map->nodes[keys[i].hash & ( map->bucket_count - 1 )] );
+}
+
+/*
+ * __hashmap_prefetch_nodes - Prefetch the first node of the buckets of a number
+ * of resolved keys. The buckets should have been prefetched already.
+ * @arg map: Hashmap
+ * @arg keys: The resolved keys
+ * @arg count: Number of keys
+ */
+static void __hashmap_prefetch_nodes( hashmap_t* map, const hashkey_t* keys, uint32 count )
+{
+	hashnode_t* node;
+	uint32 i;
+
+	if ( HASHMAP_OPEN_ADDRESSING( map ) ) return;
+
+	for ( i = 0; i < count; i++ )
+	{
+		node = map->nodes[keys[i].hash & ( map->bucket_count - 1 )];
+		if ( node ) HASHMAP_PREFETCH( node );
+	}
+}
+
+/*
+ * __hashmap_frozen_find_batch - hashmap_find_batch for the frozen engine.
+ * The slots of a whole batch are located and prefetched before any of them is read.
+ */
+static void __hashmap_frozen_find_batch( hashmap_t* map, const void* const* keys, uint32 count, void** results )
+{
+	const hashfrozen_slot_t* slots[HASHMAP_BATCH_SIZE];
+	hashkey_t resolved[HASHMAP_BATCH_SIZE];
+	uint32 i, j, n;
+
+	if ( map->size == 0 )
+	{
+		for ( i = 0; i < count; i++ )
+			results[i] = NULL;
+
+		return;
+	}
+
+	for ( i = 0; i < count; i += n )
+	{
+		n = count - i < HASHMAP_BATCH_SIZE ? count - i : HASHMAP_BATCH_SIZE;
+
+		for ( j = 0; j < n; j++ )
+		{
+			__hashmap_resolve_key( map, keys[i+j], &resolved[j] );
+
+			slots[j] = __hashmap_frozen_lookup( map, &resolved[j] );
+			HASHMAP_PREFETCH( slots[j] );
+		}
+
+		for ( j = 0; j < n; j++ )
+		{
+			HASHMAP_STAT( __hashmap_stats_lookup( map, 1 ) );
+			results[i+j] = __hashmap_frozen_match( map, slots[j], &resolved[j] );
+		}
+	}
+}
+
+/*
+ * hashmap_find_batch - Find the data of a number of keys at once.
+ * The lookups are software pipelined in groups of keys: while one group is
+ * hashed and its buckets prefetched, the first nodes of the previous group are
+ * prefetched and the group before that is resolved, so the cache misses of
+ * different keys overlap.
+ * @arg map: Hashmap to look from
+ * @arg keys: The keys, as they would be passed to hashmap_find
+ * @arg count: Number of keys
+ * @arg results: Receives the found data for each key, NULL if the key was not found
+ */
+void hashmap_find_batch( hashmap_t* map, const void* const* keys, uint32 count, void** results )
+{
+	hashkey_t resolved[3][HASHMAP_BATCH_SIZE];
+	uint32 i, j, n, group, groups;
+
+	assert( map != NULL );
+	assert( keys != NULL || count == 0 );
+	assert( results != NULL || count == 0 );
+
+	if ( map->engine == HASHMAP_FROZEN )
+	{
+		__hashmap_frozen_find_batch( map, keys, count, results );
+		return;
+	}
+
+	groups = ( count + HASHMAP_BATCH_SIZE - 1 ) / HASHMAP_BATCH_SIZE;
+
+	for ( group = 0; group < groups + 2; group++ )
+	{
+		// Stage 1: hash the keys and prefetch their buckets.
+		if ( group < groups )
+		{
+			i = group * HASHMAP_BATCH_SIZE;
+			n = count - i < HASHMAP_BATCH_SIZE ? count - i : HASHMAP_BATCH_SIZE;
+
+			for ( j = 0; j < n; j++ )
+				__hashmap_make_key( map, keys[i+j], &resolved[group % 3][j] );
+
+			__hashmap_prefetch_buckets( map, resolved[group % 3], n );
+		}
+
+		// Stage 2: the buckets of the previous group have arrived, prefetch the nodes.
+		if ( group >= 1 && group - 1 < groups )
+		{
+			i = ( group - 1 ) * HASHMAP_BATCH_SIZE;
+			n = count - i < HASHMAP_BATCH_SIZE ? count - i : HASHMAP_BATCH_SIZE;
+
+			__hashmap_prefetch_nodes( map, resolved[( group - 1 ) % 3], n );
+		}
+
+		// Stage 3: resolve the group before that.
+		if ( group >= 2 )
+		{
+			i = ( group - 2 ) * HASHMAP_BATCH_SIZE;
+			n = count - i < HASHMAP_BATCH_SIZE ? count - i : HASHMAP_BATCH_SIZE;
+
+			for ( j = 0; j < n; j++ )
+				results[i+j] = __hashmap_find( map, &resolved[( group - 2 ) % 3][j] );
+		}
+	}
+}
+
+/*
+ * hashmap_insert_batch - Insert a number of key-data pairs at once.
+ * The keys of each group are hashed and their buckets prefetched ahead of the inserts.
+ * @arg map: Hashmap
+ * @arg keys: The keys, as they would be passed to hashmap_insert
+ * @arg data: The data to be stored for each key
+ * @arg count: Number of keys
+ * @arg results: Receives the previous data of each key like hashmap_insert returns it, may be NULL
+ */
+void hashmap_insert_batch( hashmap_t* map, const void* const* keys, const void* const* data, uint32 count, void** results )
+{
+	hashkey_t resolved[HASHMAP_BATCH_SIZE];
+	uint32 i, j, n;
+	void* old;
+
+	assert( map != NULL );
+	assert( ( keys != NULL && data != NULL ) || count == 0 );
+
+	for ( i = 0; i < count; i += n )
+	{
+		n = count - i < HASHMAP_BATCH_SIZE ? count - i : HASHMAP_BATCH_SIZE;
+
+		for ( j = 0; j < n; j++ )
+			__hashmap_make_key( map, keys[i+j], &resolved[j] );
+
+		__hashmap_prefetch_buckets( map, resolved, n );
+		__hashmap_prefetch_nodes( map, resolved, n );
+
+		// An insert may grow the map, which only makes the remaining prefetches useless.
+		for ( j = 0; j < n; j++ )
+		{
+			old = __hashmap_insert( map, &resolved[j], data[i+j] );
+			if ( results ) results[i+j] = old;
+		}
+	}
+}
+
+/*
+ * __hashmap_build_worker - Hash a range of the keys given to hashmap_build_from_arrays.
+ * @arg arg: The hashbuild_t describing the range
+ */
+static void __hashmap_build_worker( void* arg )
+{
+	hashbuild_t* build = arg;
+	uint32 i;
+
+	for ( i = build->first; i < build->last; i++ )
+		__hashmap_make_key( build->map, build->keys[i], &build->resolved[i] );
+}
+
+/*
+ * hashmap_build_from_arrays - Create a hashmap and fill it from an array of keys and
+ * an array of data. The map is sized once for all the entries, so it never grows
+ * while being built. If the same key appears more than once, the last one wins.
+ * When more than one thread is requested, the keys are hashed in parallel and
+ * only linking the entries into the map is left to the calling thread.
+ * @arg engine: The storage engine to use
+ * @arg keys_type: The type of the keys
+ * @arg keys: Array of keys
+ * @arg data: Array of data, one for each key
+ * @arg count: Number of entries in the arrays
+ * @arg threads: Number of threads to hash the keys with, 0 to use every CPU
+ * @returns: Pointer to the new hashmap
+ */
+hashmap_t* hashmap_build_from_arrays( hashmap_engine_t engine, hashmap_key_type_t keys_type,
+									  const void* const* keys, const void* const* data,
+									  uint32 count, uint32 threads )
+{
+	hashmap_t* map;
+	hashkey_t* resolved;
+	hashbuild_t* builds;
+	thread_t* workers;
+	uint32 i, j, n, per_thread;
+
+	assert( ( keys != NULL && data != NULL ) || count == 0 );
+
+	map = hashmap_create_ex( 0, engine, keys_type );
+	hashmap_reserve( map, count );
+
+	if ( count == 0 ) return map;
+
+	if ( threads == 0 ) threads = thread_cpu_count();
+
+	// Spawning threads only pays off when each of them gets a decent amount of work.
+	if ( threads > count / HASHMAP_BUILD_MIN_KEYS ) threads = count / HASHMAP_BUILD_MIN_KEYS;
+	if ( threads == 0 ) threads = 1;
+
+	resolved = __hashmap_alloc( sizeof(hashkey_t) * count );
+	builds = __hashmap_alloc( sizeof(hashbuild_t) * threads );
+	workers = __hashmap_alloc( sizeof(thread_t) * threads );
+
+	per_thread = ( count + threads - 1 ) / threads;
+
+	for ( i = 0; i < threads; i++ )
+	{
+		builds[i].map = map;
+		builds[i].keys = keys;
+		builds[i].resolved = resolved;
+		builds[i].first = i * per_thread < count ? i * per_thread : count;
+		builds[i].last = builds[i].first + per_thread < count ? builds[i].first + per_thread : count;
+
+		// The calling thread hashes the first range itself.
+		if ( i > 0 ) workers[i] = thread_create( __hashmap_build_worker, &builds[i] );
+	}
+
+	__hashmap_build_worker( &builds[0] );
+
+	for ( i = 1; i < threads; i++ )
+		thread_join( workers[i] );
+
+	for ( i = 0; i < count; i += n )
+	{
+		n = count - i < HASHMAP_BATCH_SIZE ? count - i : HASHMAP_BATCH_SIZE;
+
+		__hashmap_prefetch_buckets( map, &resolved[i], n );
+
+		for ( j = 0; j < n; j++ )
+			__hashmap_insert( map, &resolved[i+j], data[i+j] );
+	}
+
+	__hashmap_free( workers );
+	__hashmap_free( builds );
+	__hashmap_free( resolved );
+
+	return map;
+}
+
+/*
+ * __hashmap_freeze_place - Find a displacement pair for every bucket of a snapshot
+ * under construction (compress, hash and displace). The largest buckets are placed
+ * first while the slots are still mostly free, buckets of a single key simply take
+ * the next free slot.
+ * @arg keys: The keys, their positions already calculated
+ * @arg count: Number of keys, also the number of slots
+ * @arg buckets: Number of displacement buckets
+ * @arg displace: Two displacements for each bucket, filled by this function
+ * @returns: true if every key got a slot of its own, false if a new seed is needed
+ */
+static bool __hashmap_freeze_place( hashfreeze_t* keys, uint32 count, uint32 buckets, uint32* displace )
+{
+	uint32 *first, *members, *order, *by_size;
+	uint32 i, j, b, size, max_size, cursor, tries, d0, d1;
+	uint8* taken;
+	hashfreeze_t* key;
+	bool placed = true;
+
+	first = __hashmap_alloc( sizeof(uint32) * ( buckets + 1 ) );
+	members = __hashmap_alloc( sizeof(uint32) * ( count + 1 ) );
+	order = __hashmap_alloc( sizeof(uint32) * buckets );
+	taken = __hashmap_alloc( count + 1 );
+
+	memset( first, 0, sizeof(uint32) * ( buckets + 1 ) );
+	memset( displace, 0, sizeof(uint32) * 2 * buckets );
+	memset( taken, 0, count + 1 );
+
+	// Group the keys by bucket, first[b] ends up as the index of the first key of bucket b.
+	for ( i = 0; i < count; i++ )
+		first[keys[i].pos.bucket]++;
+
+	for ( b = 0, max_size = 0; b < buckets; b++ )
+	{
+		if ( first[b] > max_size ) max_size = first[b];
+		if ( b > 0 ) first[b] += first[b-1];
+	}
+
+	first[buckets] = count;
+
+	for ( i = 0; i < count; i++ )
+		members[--first[keys[i].pos.bucket]] = i;
+
+	// Sort the buckets by size, largest first.
+	by_size = __hashmap_alloc( sizeof(uint32) * ( max_size + 2 ) );
+	memset( by_size, 0, sizeof(uint32) * ( max_size + 2 ) );
+
+	for ( b = 0; b < buckets; b++ )
+		by_size[max_size - ( first[b+1] - first[b] ) + 1]++;
+
+	for ( i = 0; i <= max_size; i++ )
+		by_size[i+1] += by_size[i];
+
+	for ( b = 0; b < buckets; b++ )
+		order[by_size[max_size - ( first[b+1] - first[b] )]++] = b;
+
+	for ( i = 0, cursor = 0; i < buckets && placed; i++ )
+	{
+		b = order[i];
+		size = first[b+1] - first[b];
+
+		if ( size == 0 ) break;
+
+		if ( size == 1 )
+		{
+			while ( taken[cursor] ) cursor++;
+
+			key = &keys[members[first[b]]];
+			key->slot = cursor;
+			taken[cursor] = 1;
+
+			displace[2 * b + 1] = ( cursor + count - key->pos.f1 ) % count;
+			continue;
+		}
+
+		placed = false;
+
+		for ( tries = 0, d0 = 0, d1 = 0; tries < HASHMAP_FROZEN_MAX_TRIES; tries++ )
 		{
-			if ( map->key_equals( key, node->key ) )
+			for ( j = 0; j < size; j++ )
+			{
+				key = &keys[members[first[b] + j]];
+				key->slot = __hashmap_frozen_slot( &key->pos, d0, d1, count );
+
+				if ( taken[key->slot] ) break;
+				taken[key->slot] = 1;
+			}
+
+			if ( j == size )
+			{
+				displace[2 * b] = d0;
+				displace[2 * b + 1] = d1;
+				placed = true;
+				break;
+			}
+
+			// Some key collided, release the slots taken by the ones before it.
+			while ( j-- > 0 )
+				taken[keys[members[first[b] + j]].slot] = 0;
+
+			if ( ++d1 == count )
 			{
-				return (void*)node->data;
+				d1 = 0;
+				d0++;
 			}
 		}
 	}
 
-	return NULL;
+	__hashmap_free( by_size );
+	__hashmap_free( taken );
+	__hashmap_free( order );
+	__hashmap_free( members );
+	__hashmap_free( first );
+
+	return placed;
 }
 
 /*
- * hashmap_clear - Remove all nodes from a hash table.
- * @arg map: The hash map to be cleared
- * @returns: -
+ * __hashmap_freeze_blob - Compile a map into a frozen snapshot.
+ * @arg map: The map to freeze. Custom keys must have a key_size function.
+ * @arg data_size: When set, the data is copied into the snapshot, NULL stores the data pointers
+ * @returns: The snapshot, or NULL if no perfect hash was found
  */
-void hashmap_clear( hashmap_t* map )
+static hashfrozen_t* __hashmap_freeze_blob( hashmap_t* map, data_size_func_t data_size )
 {
-	uint32 i;
-	hashnode_t *node, *tmp;
+	hashfrozen_t* frozen;
+	hashfrozen_slot_t* slots;
+	hashfreeze_t *keys, *key;
+	hashmap_iter_t iter;
+	hashkey_t k;
+	uint32 *displace, *slot_keys;
+	uint32 i, count, buckets, attempt;
+	uint64 seed, size, offset, values, len;
 
 	assert( map != NULL );
-	assert( map->nodes != NULL );
+	assert( HASHMAP_INLINE_KEYS( map ) || map->key_size != NULL );
+	assert( HASHMAP_INLINE_KEYS( map ) || HASHMAP_ARENA_KEYS( map ) || map->key_size != __hashmap_key_size ); // key_size left over from the string keys
 
-	for ( i = 0; i < map->bucket_count; i++ )
+	count = map->size;
+	buckets = count / HASHMAP_FROZEN_BUCKET_KEYS + 1;
+
+	keys = __hashmap_alloc( sizeof(hashfreeze_t) * ( count + 1 ) );
+	displace = __hashmap_alloc( sizeof(uint32) * 2 * buckets );
+
+	i = 0;
+
+	hashmap_foreach( map, iter )
+	{
+		keys[i].key = HASHMAP_INLINE_KEYS( map ) ? iter.ikey : (uint64)(size_t)iter.key;
+		keys[i].data = iter.data;
+		i++;
+	}
+
+	assert( i == count );
+
+	for ( attempt = 0, seed = 0; attempt < HASHMAP_FROZEN_MAX_SEEDS; attempt++ )
+	{
+		seed = __hashmap_fmix64( HASHMAP_WY0 + attempt );
+
+		for ( i = 0; i < count; i++ )
+		{
+			k.ptr = (const void*)(size_t)keys[i].key;
+			k.value = keys[i].key;
+			k.len = HASHMAP_STRING_KEYS( map ) ? strlen( (const char*)k.ptr ) : HASHMAP_NO_LEN;
+
+			__hashmap_frozen_pos( __hashmap_frozen_hash( map, &k, seed ), count, buckets, &keys[i].pos );
+		}
+
+		if ( __hashmap_freeze_place( keys, count, buckets, displace ) ) break;
+	}
+
+	if ( attempt == HASHMAP_FROZEN_MAX_SEEDS )
+	{
+		__hashmap_free( displace );
+		__hashmap_free( keys );
+		return NULL;
+	}
+
+	// Lay out the snapshot: header, displacements, slots, the packed keys and the packed data.
+	size = HASHMAP_FROZEN_ALIGN( sizeof(hashfrozen_t) + sizeof(uint32) * 2 * buckets );
+	offset = size;
+	size += sizeof(hashfrozen_slot_t) * count;
+	values = 0;
+
+	if ( !HASHMAP_INLINE_KEYS( map ) )
+	{
+		for ( i = 0; i < count; i++ )
+			size += HASHMAP_FROZEN_ALIGN( map->key_size( (const void*)(size_t)keys[i].key ) );
+	}
+
+	if ( data_size )
+	{
+		values = size;
+
+		for ( i = 0; i < count; i++ )
+			size += HASHMAP_FROZEN_ALIGN( data_size( keys[i].data ) );
+	}
+
+	frozen = __hashmap_alloc( (size_t)size );
+	memset( frozen, 0, sizeof(*frozen) );
+
+	frozen->magic = HASHMAP_FROZEN_MAGIC;
+	frozen->version = HASHMAP_FROZEN_VERSION;
+	frozen->key_type = map->key_type;
+	frozen->count = count;
+	frozen->bucket_count = buckets;
+	frozen->seed = seed;
+	frozen->size = size;
+	frozen->displace = sizeof(hashfrozen_t);
+	frozen->slots = offset;
+	frozen->keys = HASHMAP_INLINE_KEYS( map ) ? 0 : offset + sizeof(hashfrozen_slot_t) * count;
+	frozen->values = values;
+
+	memcpy( (uint8*)frozen + frozen->displace, displace, sizeof(uint32) * 2 * buckets );
+
+	// Pack the keys and data in slot order, so neighbouring slots have them close by.
+	slot_keys = __hashmap_alloc( sizeof(uint32) * ( count + 1 ) );
+	slots = (hashfrozen_slot_t*)( (uint8*)frozen + frozen->slots );
+
+	for ( i = 0; i < count; i++ )
+		slot_keys[keys[i].slot] = i;
+
+	for ( i = 0, offset = frozen->keys; i < count; i++ )
 	{
-		for ( node = map->nodes[i]; node; node = tmp )
+		key = &keys[slot_keys[i]];
+
+		if ( data_size )
 		{
-			tmp = node->next;
+			len = data_size( key->data );
+			memcpy( (uint8*)frozen + values, key->data, (size_t)len );
 
-			if ( map->data_destroy )
-				map->data_destroy( node->data );
+			slots[i].data = values;
+			values += HASHMAP_FROZEN_ALIGN( len );
+		}
+		else
+		{
+			slots[i].data = (uint64)(size_t)key->data;
+		}
 
-			__hashmap_free( node->key );
-			__hashmap_free( node );
+		if ( HASHMAP_INLINE_KEYS( map ) )
+		{
+			slots[i].key = key->key;
+			continue;
 		}
+
+		len = map->key_size( (const void*)(size_t)key->key );
+		memcpy( (uint8*)frozen + offset, (const void*)(size_t)key->key, (size_t)len );
+
+		slots[i].key = offset;
+		offset += HASHMAP_FROZEN_ALIGN( len );
 	}
 
-	map->size = 0;
+	__hashmap_free( slot_keys );
+	__hashmap_free( displace );
+	__hashmap_free( keys );
+
+	return frozen;
 }
 
 /*
- * __hashmap_rehash_insert - A helper func to insert rehashed
- * nodes back into the hashmap.
- * @arg map: The hashmap that was rehashed.
- * @arg node: The node to be re-inserted
- * @returns: -
+ * __hashmap_frozen_create - Create a frozen map around a snapshot.
+ * @arg frozen: The snapshot
+ * @arg funcs: Key functions of the map
+ * @arg mapped: The snapshot is a mapped file instead of allocated memory
+ * @returns: Pointer to the frozen map
  */
-static void __hashmap_rehash_insert( hashmap_t* map, hashnode_t* node )
+static hashmap_t* __hashmap_frozen_create( hashfrozen_t* frozen, const hashmap_key_funcs_t* funcs, bool mapped )
 {
-	uint32 hash;
-	hashnode_t* bucket;
-	
-	hash = map->key_hash( node->key ) % map->bucket_count;
-	bucket = map->nodes[hash];
+	hashmap_t* map;
 
-	if ( !bucket )
-		node->next = NULL;
-	else
-		node->next = bucket;
-	
-	map->nodes[hash] = node;
+	map = __hashmap_alloc( sizeof(*map) );
+	memset( map, 0, sizeof(*map) );
+
+	hashmap_set_key_funcs( map, funcs );
+
+	map->size = frozen->count;
+	map->bucket_count = frozen->count;
+	map->load_factor = frozen->count ? 1.0f : 0.0f;
+	map->max_load_factor = 1.0f;
+	map->engine = HASHMAP_FROZEN;
+	map->key_type = (hashmap_key_type_t)frozen->key_type;
+	map->frozen = frozen;
+	map->frozen_mapped = mapped;
+
+	return map;
 }
 
 /*
- * hashmap_rehash - Rehash the map and allocate extra space if needed.
- * @arg map: The hash map to be rehashed
- * @arg buckets: How many buckets the rehashed map should have
- * @returns: -
+ * hashmap_freeze - Compile a map into a read-only snapshot using a minimal perfect
+ * hash (CHD). Every key has exactly one slot it can be in, so lookups take a single
+ * probe, and the keys are packed into the same block of memory as the slots.
+ * The snapshot works with hashmap_find, hashmap_find_int, hashmap_find_batch and
+ * the iterators, it can't be modified. It shares the data pointers with the source
+ * map, which stays unchanged and keeps owning the data.
+ * @arg map: The map to freeze. Custom keys must have a key_size function.
+ * @returns: Pointer to the frozen map, or NULL if no perfect hash was found
  */
-void hashmap_rehash( hashmap_t* map, uint32 buckets )
+hashmap_t* hashmap_freeze( hashmap_t* map )
 {
-	hashnode_t** nodes;
-	hashnode_t *node, *next;
-	uint32 i, old_buckets;
+	hashmap_key_funcs_t funcs;
+	hashfrozen_t* frozen;
+
+	frozen = __hashmap_freeze_blob( map, NULL );
+	if ( !frozen ) return NULL;
+
+	funcs.key_hash = map->key_hash;
+	funcs.key_equals = map->key_equals;
+	funcs.key_dup = map->key_dup;
+	funcs.key_free = map->key_free;
+	funcs.key_size = map->key_size;
+
+	return __hashmap_frozen_create( frozen, &funcs, false );
+}
+
+/*
+ * hashmap_save - Write a frozen snapshot of a map into a file, which can later be
+ * opened with hashmap_open. The file uses the byte order of the machine writing it.
+ * @arg map: The map to save. Custom keys must have a key_size function.
+ * @arg path: Path of the file
+ * @arg data_size: Size of the data of an entry in bytes. The data is copied into the
+ *                 file, NULL writes the data pointers themselves (for integer data).
+ * @returns: true if the file was written successfully
+ */
+bool hashmap_save( hashmap_t* map, const char* path, data_size_func_t data_size )
+{
+	hashfrozen_t* frozen;
+	FILE* file;
+	bool success;
 
 	assert( map != NULL );
-	assert( map->nodes != NULL );
+	assert( path != NULL );
 
-	if ( buckets == 0 ) return;
+	frozen = __hashmap_freeze_blob( map, data_size );
+	if ( !frozen ) return false;
 
-	nodes = map->nodes;
-	old_buckets = map->bucket_count;
+	file = fopen( path, "wb" );
 
-	map->nodes = __hashmap_alloc( sizeof(hashnode_t*) * buckets );
-	map->bucket_count = buckets;
+	if ( !file )
+	{
+		__hashmap_free( frozen );
+		return false;
+	}
 
-	memset( map->nodes, 0, sizeof(hashnode_t*) * buckets );
+	success = fwrite( frozen, 1, (size_t)frozen->size, file ) == frozen->size;
+	success = fclose( file ) == 0 && success;
+
+	__hashmap_free( frozen );
+
+	return success;
+}
+
+/*
+ * __hashmap_frozen_valid - Check that the header of a mapped snapshot describes a
+ * snapshot that fits in the file. The entries themselves are not checked, so
+ * opening a file doesn't have to touch every page of it.
+ * @arg frozen: The snapshot
+ * @arg size: Size of the file
+ * @returns: true if the snapshot can be used
+ */
+static bool __hashmap_frozen_valid( const hashfrozen_t* frozen, uint64 size )
+{
+	if ( size < sizeof(hashfrozen_t) ) return false;
 
-	for ( i = 0; i < old_buckets; i++ )
+	if ( frozen->magic != HASHMAP_FROZEN_MAGIC ||
+		 frozen->version != HASHMAP_FROZEN_VERSION ||
+		 frozen->key_type >= HASHMAP_KEY_TYPES ||
+		 frozen->size != size ||
+		 frozen->bucket_count == 0 )
 	{
-		for ( node = nodes[i]; node; node = next )
+		return false;
+	}
+
+	// The offsets come from the file, compare without sums that could wrap around.
+	if ( frozen->displace > size ||
+		 frozen->bucket_count > ( size - frozen->displace ) / ( sizeof(uint32) * 2 ) ||
+		 frozen->slots > size ||
+		 frozen->count > ( size - frozen->slots ) / sizeof(hashfrozen_slot_t) ||
+		 frozen->slots % HASHMAP_ARENA_ALIGN != 0 ||
+		 frozen->keys > size ||
+		 frozen->values > size )
+	{
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * hashmap_open - Open a file written by hashmap_save. The file is mapped into memory
+ * and queried in place, so opening it takes the same time regardless of its size
+ * and only the pages actually looked at are ever read. The returned map is frozen.
+ * @arg path: Path of the file
+ * @arg funcs: Key functions of the saved map if it had custom ones, NULL to use the
+ * ready-made functions of the saved key type. The snapshot hashes the key_size bytes
+ * of a key instead of using key_hash, so equal keys must have equal bytes.
+ * @returns: Pointer to the frozen map, or NULL if the file couldn't be opened or is not a valid snapshot
+ */
+hashmap_t* hashmap_open( const char* path, const hashmap_key_funcs_t* funcs )
+{
+	hashfrozen_t* frozen;
+	uint64 size;
+
+#ifdef _WIN32
+	HANDLE file, mapping;
+	LARGE_INTEGER file_size;
+
+	assert( path != NULL );
+
+	file = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( file == INVALID_HANDLE_VALUE ) return NULL;
+
+	if ( !GetFileSizeEx( file, &file_size ) || file_size.QuadPart < (LONGLONG)sizeof(hashfrozen_t) )
+	{
+		CloseHandle( file );
+		return NULL;
+	}
+
+	size = (uint64)file_size.QuadPart;
+	mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+
+	// The view keeps the mapping alive, the handles are no longer needed.
+	frozen = mapping ? MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 ) : NULL;
+
+	if ( mapping ) CloseHandle( mapping );
+	CloseHandle( file );
+
+	if ( !frozen ) return NULL;
+
+	if ( !__hashmap_frozen_valid( frozen, size ) )
+	{
+		UnmapViewOfFile( frozen );
+		return NULL;
+	}
+#else
+	struct stat info;
+	int file;
+
+	assert( path != NULL );
+
+	file = open( path, O_RDONLY );
+	if ( file < 0 ) return NULL;
+
+	if ( fstat( file, &info ) != 0 || info.st_size < (off_t)sizeof(hashfrozen_t) )
+	{
+		close( file );
+		return NULL;
+	}
+
+	size = (uint64)info.st_size;
+	frozen = mmap( NULL, (size_t)size, PROT_READ, MAP_SHARED, file, 0 );
+
+	// The mapping stays valid after the file is closed.
+	close( file );
+
+	if ( frozen == MAP_FAILED ) return NULL;
+
+	if ( !__hashmap_frozen_valid( frozen, size ) )
+	{
+		munmap( frozen, (size_t)size );
+		return NULL;
+	}
+#endif
+
+	// Custom key functions work on keys handled by functions, never on inline integer keys.
+	assert( funcs == NULL || frozen->key_type == HASHMAP_KEY_STRING );
+
+	if ( funcs == NULL )
+		funcs = hashmap_key_funcs( (hashmap_key_type_t)frozen->key_type );
+
+	return __hashmap_frozen_create( frozen, funcs, true );
+}
+
+#ifdef MYLLY_HASHMAP_STATS
+
+/*
+ * __hashmap_stats_chain - Count a chain (or a probe sequence) into the histogram.
+ * @arg stats: The statistics
+ * @arg length: Length of the chain
+ */
+static void __hashmap_stats_chain( hashmap_stats_t* stats, uint32 length )
+{
+	stats->chains[length < HASHMAP_STATS_CHAINS ? length : HASHMAP_STATS_CHAINS - 1]++;
+}
+
+/*
+ * hashmap_get_stats - Collect the statistics of a map. The counters are updated
+ * by the operations, the chain histogram and the memory use are calculated by
+ * walking the map, which takes time proportional to its size.
+ * Only available when built with MYLLY_HASHMAP_STATS.
+ * @arg map: Hashmap
+ * @arg stats: The collected statistics
+ */
+void hashmap_get_stats( hashmap_t* map, hashmap_stats_t* stats )
+{
+	hashnode_t* node;
+	uint32 i, mask, group, step, length;
+
+	assert( map != NULL );
+	assert( stats != NULL );
+
+	memset( stats, 0, sizeof(*stats) );
+
+	stats->counters = map->counters;
+	stats->avg_probes = map->counters.lookups ? (float)map->counters.probes / map->counters.lookups : 0.0f;
+	stats->node_bytes = map->node_bytes;
+	stats->key_bytes = map->key_arena.bytes;
+
+	switch ( map->engine )
+	{
+	case HASHMAP_FROZEN:
+		stats->chains[1] = map->size;
+		stats->bucket_bytes = map->frozen->size;
+		break;
+
+	case HASHMAP_FLAT:
+	case HASHMAP_DENSE:
+		mask = map->bucket_count / HASHMAP_GROUP_WIDTH - 1;
+
+		// Replay the probe sequence of each entry to see how many groups a lookup visits.
+		for ( i = 0; i < map->bucket_count; i++ )
 		{
-			next = node->next;
+			if ( map->ctrl[i] & 0x80 ) continue;
 
-			__hashmap_rehash_insert( map, node );
+			group = ( __hashmap_flat_mix( __hashmap_flat_entry( map, i )->hash ) >> 7 ) & mask;
+
+			for ( step = 0; group != i / HASHMAP_GROUP_WIDTH; step++ )
+				group = ( group + step + 1 ) & mask;
+
+			__hashmap_stats_chain( stats, step + 1 );
+		}
+
+		stats->bucket_bytes = (uint64)map->bucket_count;
+
+		if ( map->engine == HASHMAP_DENSE )
+		{
+			stats->bucket_bytes += (uint64)map->bucket_count * sizeof(uint32);
+			stats->bucket_bytes += (uint64)map->entry_capacity * sizeof(hashslot_t);
+		}
+		else
+		{
+			stats->bucket_bytes += (uint64)map->bucket_count * sizeof(hashslot_t);
+		}
+		break;
+
+	default:
+		for ( i = 0; i < map->bucket_count; i++ )
+		{
+			for ( length = 0, node = map->nodes[i]; node; node = node->next )
+				length++;
+
+			__hashmap_stats_chain( stats, length );
+		}
+
+		for ( i = map->rehash_index; i < map->old_bucket_count; i++ )
+		{
+			for ( length = 0, node = map->old_nodes[i]; node; node = node->next )
+				length++;
+
+			__hashmap_stats_chain( stats, length );
 		}
+
+		stats->bucket_bytes = (uint64)( map->bucket_count + map->old_bucket_count ) * sizeof(hashnode_t*);
+		break;
 	}
 
-	__hashmap_free( nodes );
+	stats->filter_bytes = map->filter ? (uint64)map->filter_blocks * HASHMAP_FILTER_BLOCK : 0;
+	stats->total_bytes = stats->node_bytes + stats->key_bytes + stats->bucket_bytes + stats->filter_bytes + sizeof(*map);
+}
+
+/*
+ * hashmap_reset_stats - Reset the operation counters of a map.
+ * Only available when built with MYLLY_HASHMAP_STATS.
+ * @arg map: Hashmap
+ */
+void hashmap_reset_stats( hashmap_t* map )
+{
+	assert( map != NULL );
+
+	memset( &map->counters, 0, sizeof(map->counters) );
+}
+
+#endif /* MYLLY_HASHMAP_STATS */
+
+/*
+ * hashmap_iter_begin - Start iterating over the entries of a map. The map must
+ * not be modified, and a map with an incremental rehash in progress must not be
+ * searched either, until the iteration is finished.
+ * @arg map: The map to iterate over
+ * @arg iter: The iterator to initialize
+ */
+void hashmap_iter_begin( hashmap_t* map, hashmap_iter_t* iter )
+{
+	assert( map != NULL );
+	assert( iter != NULL );
+
+	iter->map = map;
+	iter->index = 0;
+	iter->node = NULL;
+	iter->old = false;
+	iter->key = NULL;
+	iter->data = NULL;
+}
+
+/*
+ * hashmap_iter_next - Advance an iterator to the next entry.
+ * Dense maps are iterated in insertion order, touching only the entry array.
+ * @arg iter: The iterator
+ * @returns: true if the iterator key and data were set to the next entry, false at the end
+ */
+bool hashmap_iter_next( hashmap_iter_t* iter )
+{
+	hashmap_t* map;
+	hashnode_t* node;
+	hashslot_t* entry;
+	const hashfrozen_slot_t* fslot;
+
+	assert( iter != NULL );
+
+	map = iter->map;
+
+	switch ( map->engine )
+	{
+	case HASHMAP_FROZEN:
+		if ( iter->index >= map->size ) return false;
+
+		fslot = &( (const hashfrozen_slot_t*)HASHMAP_FROZEN_AT( map->frozen, map->frozen->slots ) )[iter->index++];
+
+		if ( HASHMAP_INLINE_KEYS( map ) )
+			iter->ikey = fslot->key;
+		else
+			iter->key = HASHMAP_FROZEN_AT( map->frozen, fslot->key );
+
+		iter->data = __hashmap_frozen_data( map->frozen, fslot );
+		return true;
+
+	case HASHMAP_DENSE:
+		for ( ; iter->index < map->entry_count; iter->index++ )
+		{
+			entry = &map->entries[iter->index];
+			if ( entry->erased ) continue;
+
+			iter->ikey = entry->ikey;
+			iter->data = (void*)entry->data;
+			iter->index++;
+			return true;
+		}
+		return false;
+
+	case HASHMAP_FLAT:
+		for ( ; iter->index < map->bucket_count; iter->index++ )
+		{
+			if ( map->ctrl[iter->index] & 0x80 ) continue;
+
+			entry = &map->slots[iter->index];
+			iter->ikey = entry->ikey;
+			iter->data = (void*)entry->data;
+			iter->index++;
+			return true;
+		}
+		return false;
+
+	default:
+		for ( ;; )
+		{
+			if ( iter->node )
+			{
+				node = iter->node;
+				iter->node = node->next;
+				iter->ikey = node->ikey;
+				iter->data = (void*)node->data;
+				return true;
+			}
+
+			if ( !iter->old && iter->index >= map->bucket_count )
+			{
+				// Continue with the buckets an incremental rehash hasn't migrated yet.
+				if ( !map->old_nodes ) return false;
+
+				iter->old = true;
+				iter->index = map->rehash_index;
+			}
+
+			if ( iter->old )
+			{
+				if ( iter->index >= map->old_bucket_count ) return false;
+				iter->node = map->old_nodes[iter->index++];
+			}
+			else
+			{
+				iter->node = map->nodes[iter->index++];
+			}
+		}
+	}
 }
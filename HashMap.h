@@ -14,41 +14,251 @@
 #define __MYLLY_HASHMAP_H
 
 #include "stdtypes.h"
+#include "Tree.h"
 
 typedef uint32	( *hash_func_t )	( const void* );
 typedef bool	( *key_func_t )		( const void*, const void* );
 typedef void*	( *key_dup_func_t )	( const void* );
 typedef void	( *data_destruct_t )( const void* );
+typedef size_t	( *key_size_func_t )( const void* );
+typedef size_t	( *data_size_func_t )( const void* );
+
+#define HASHMAP_ARENA_CLASSES	(32)	// Key arena keeps free lists for keys up to 32*8 bytes
+
+#ifndef HASHMAP_SMALL_KEY_SIZE
+#define HASHMAP_SMALL_KEY_SIZE	(24)	// Default size of the keys stored in the nodes themselves
+#endif
+
+typedef enum {
+	HASHMAP_KEY_STRING,				// Keys handled by the key functions, NUL-terminated strings by default
+	HASHMAP_KEY_UINT32,				// Pointers to a uint32, the value is stored in the node
+	HASHMAP_KEY_UINT64,				// Pointers to a uint64, the value is stored in the node
+	HASHMAP_KEY_POINTER,			// The pointer itself is the key and is stored in the node
+	HASHMAP_KEY_TYPES,
+} hashmap_key_type_t;
+
+typedef struct {
+	hash_func_t		key_hash;		// Hash function
+	key_func_t		key_equals;		// Key comparison function
+	key_dup_func_t	key_dup;		// Function to duplicate a key
+	data_destruct_t	key_free;		// Function to free a duplicated key
+	key_size_func_t	key_size;		// Size of a key in bytes, NULL if the key can't be copied into the arena. Keys are only copied with the default key_dup
+} hashmap_key_funcs_t;
+
+typedef enum {
+	HASHMAP_CHAINED,				// Separate chaining, every entry is a linked hash node (default)
+	HASHMAP_FLAT,					// Open addressing with SIMD probed control bytes (Swiss table)
+	HASHMAP_DENSE,					// Like flat, but the slots index a dense entry array kept in insertion order
+	HASHMAP_FROZEN,					// Read-only minimal perfect hash snapshot, created by hashmap_freeze
+} hashmap_engine_t;
 
 typedef struct hnode_s {
 	const void*		data;			// Stored data
+	union {
 	const void*		key;			// Key assigned to this data node
+	uint64			ikey;			// Integer or pointer key stored in the node
+	};
+	uint32			hash;			// Full hash of the key
 	struct hnode_s*	next;			// Pointer to next data node
 } hashnode_t;
 
+typedef struct hblock_s {
+	struct hblock_s* next;			// Next block owned by the same map
+} hashblock_t;
+
+typedef struct {
+	hashblock_t*	blocks;			// Blocks the keys are allocated from
+	uint8*			cursor;			// Next free byte in the current block
+	uint8*			end;			// End of the current block
+	void*			free[HASHMAP_ARENA_CLASSES]; // Released keys per 8 byte size class
+	uint32			large_keys;		// Keys too large for the size classes, allocated from the heap
+#ifdef MYLLY_HASHMAP_STATS
+	uint64			bytes;			// Bytes allocated for the blocks and the large keys
+#endif
+} hasharena_t;
+
+typedef struct {
+	uint32			hash;			// Full hash of the key
+	uint32			erased;			// The entry has been erased, dense engine only
+	union {
+	const void*		key;			// Key assigned to this slot
+	uint64			ikey;			// Integer or pointer key stored in the slot
+	};
+	const void*		data;			// Stored data
+} hashslot_t;
+
+// Header of a frozen snapshot. The snapshot is a single block of memory
+// and refers to its parts by offsets from the start of the header, so it
+// can be written to a file as is and used straight from a mapping.
+typedef struct {
+	uint32			magic;			// Identifies a frozen snapshot
+	uint32			version;		// Version of the snapshot layout
+	uint32			key_type;		// Type of the keys, hashmap_key_type_t
+	uint32			count;			// Number of entries, also the number of slots
+	uint32			bucket_count;	// Number of displacement buckets
+	uint32			reserved;		// Padding, always zero
+	uint64			seed;			// Seed of the key hash the displacements were found with
+	uint64			size;			// Size of the whole snapshot in bytes
+	uint64			displace;		// Offset of the displacement pairs, two uint32s per bucket
+	uint64			slots;			// Offset of the slots
+	uint64			keys;			// Offset of the packed keys, 0 for integer and pointer keys
+	uint64			values;			// Offset of the packed data, 0 if the slots hold the data pointers
+} hashfrozen_t;
+
+typedef struct {
+	uint64			key;			// Integer or pointer key, or offset of the packed key
+	uint64			data;			// Stored data, or offset of the packed data
+} hashfrozen_slot_t;
+
+#ifdef MYLLY_HASHMAP_STATS
+
+#define HASHMAP_STATS_CHAINS	(16)	// Length classes in the chain histogram, the last one includes everything longer
+
+// Counters updated by the operations of a map when built with MYLLY_HASHMAP_STATS.
+typedef struct {
+	uint64			lookups;		// Keys looked up by find, insert and erase
+	uint64			probes;			// Nodes, slot groups or frozen slots visited by the lookups
+	uint32			max_probes;		// Most probes taken by a single lookup
+	uint32			rehashes;		// Rehashes done or started (incremental rehash)
+	uint64			key_compares;	// Calls to the key_equals function
+	uint64			filtered;		// Lookups the Bloom filter found to be misses
+	uint64			rehash_usecs;	// Time spent rehashing in microseconds
+} hashmap_counters_t;
+
+typedef struct {
+	hashmap_counters_t counters;	// The counters of the map
+	float			avg_probes;		// Average probes per lookup
+	uint32			chains[HASHMAP_STATS_CHAINS]; // Chained: buckets by number of nodes. Other engines: entries by probes needed to find them
+	uint64			node_bytes;		// Bytes held by the node slab
+	uint64			key_bytes;		// Bytes held by the key arena, keys copied by key_dup are not included
+	uint64			bucket_bytes;	// Bytes held by the buckets, control bytes, slots and entries, or the frozen snapshot
+	uint64			filter_bytes;	// Bytes held by the Bloom filter
+	uint64			total_bytes;	// All of the above plus the map itself
+} hashmap_stats_t;
+
+#endif /* MYLLY_HASHMAP_STATS */
+
 typedef struct {
 	uint32			size;			// Number of elements stored
 	uint32			bucket_count;	// Number of buckets in the hashmap
 	float			load_factor;	// Current load factor
 	float			max_load_factor;// Maximum load factor
-	hashnode_t**	nodes;			// The data nodes (buckets)
+	hashmap_engine_t engine;		// Storage engine used by this map
+	hashmap_key_type_t key_type;	// Type of the keys, integer and pointer keys bypass the key functions
+	hashnode_t**	nodes;			// The data nodes (buckets), chained engine only
+	tree_t**		trees;			// Trees of the buckets whose chains grew too long, NULL if there are none
+	hashnode_t**	old_nodes;		// Buckets still being migrated by an incremental rehash
+	uint32			old_bucket_count;// Number of buckets in old_nodes
+	uint32			rehash_index;	// Next old bucket to be migrated
+	uint32			rehash_step;	// Buckets migrated per operation, 0 rehashes all at once (chained engine only)
+	uint8*			ctrl;			// Control bytes for each slot, flat engine only
+	hashslot_t*		slots;			// The data slots, flat engine only
+	uint32			tombstones;		// Number of erased but unreclaimed slots, flat and dense engines
+	uint32*			index;			// Entry index of each slot, dense engine only
+	hashslot_t*		entries;		// Entries in insertion order, dense engine only
+	uint32			entry_count;	// Number of entries used, erased ones included, dense engine only
+	uint32			entry_capacity;	// Number of entries allocated, dense engine only
+	hashfrozen_t*	frozen;			// The snapshot, frozen engine only
+	bool			frozen_mapped;	// The snapshot is a file mapped by hashmap_open
+	hashblock_t*	node_blocks;	// Slab blocks the nodes are allocated from, chained engine only
+	hashnode_t*		free_nodes;		// Unused nodes in the slab blocks
+	uint32			node_block_size;// Number of nodes in the next slab block
+	uint32			small_key_size;	// Keys up to this size are stored right after their node, chained engine only
+	uint32*			filter;			// Blocked Bloom filter of the key hashes, NULL if disabled
+	void*			filter_alloc;	// Allocation the filter blocks are aligned in
+	uint32			filter_blocks;	// Number of cache line sized blocks in the filter, a power of two
+	uint32			filter_bits;	// Filter bits per key
+	uint32			filter_capacity;// Number of keys the filter was sized for
+	uint32			filter_erased;	// Keys erased since the filter was built, their bits are still set
+	hasharena_t		key_arena;		// Storage for keys copied by key_size
 	hash_func_t		key_hash;		// Hash function
 	key_func_t		key_equals;		// Key comparison function
 	key_dup_func_t	key_dup;		// Function to duplicate a key
+	data_destruct_t	key_free;		// Function to free a duplicated key
+	key_size_func_t	key_size;		// When set, keys are copied into key_arena instead of using key_dup/key_free
 	data_destruct_t	data_destroy;	// A custom destructor for the saved data
+#ifdef MYLLY_HASHMAP_STATS
+	hashmap_counters_t counters;	// Operation counters, see hashmap_get_stats
+	uint64			node_bytes;		// Bytes allocated for the node slab
+#endif
 } hashmap_t;
 
+typedef struct {
+	hashmap_t*		map;			// The map being iterated
+	uint32			index;			// Next bucket, slot or entry
+	hashnode_t*		node;			// Next node in the current chain, chained engine only
+	bool			old;			// Iterating the buckets an incremental rehash hasn't migrated yet
+	union {
+	const void*		key;			// Key of the current entry
+	uint64			ikey;			// Key of the current entry if the map has integer or pointer keys
+	};
+	void*			data;			// Data of the current entry
+} hashmap_iter_t;
+
+/*
+ * hashmap_foreach - A macro to loop through every entry of a hashmap
+ * @map: The map to loop through
+ * @iter: A hashmap_iter_t loop variable, holds the key and data of the entry
+ */
+#define hashmap_foreach(map,iter)         \
+	for ( hashmap_iter_begin( map, &iter ); \
+	      hashmap_iter_next( &iter ); )     \
+
 __BEGIN_DECLS
 
 MYLLY_API hashmap_t*	hashmap_create			( uint32 size );
+MYLLY_API hashmap_t*	hashmap_create_ex		( uint32 size, hashmap_engine_t engine, hashmap_key_type_t keys );
 MYLLY_API void			hashmap_destroy			( hashmap_t* map );
 
 MYLLY_API void*			hashmap_insert			( hashmap_t* map, const void* key, const void* data );
 MYLLY_API void*			hashmap_erase			( hashmap_t* map, const void* key );
 MYLLY_API void*			hashmap_find			( hashmap_t* map, const void* key );
 
+MYLLY_API void*			hashmap_insert_int		( hashmap_t* map, uint64 key, const void* data );
+MYLLY_API void*			hashmap_erase_int		( hashmap_t* map, uint64 key );
+MYLLY_API void*			hashmap_find_int		( hashmap_t* map, uint64 key );
+
+MYLLY_API void*			hashmap_insert_n		( hashmap_t* map, const char* key, size_t len, const void* data );
+MYLLY_API void*			hashmap_erase_n			( hashmap_t* map, const char* key, size_t len );
+MYLLY_API void*			hashmap_find_n			( hashmap_t* map, const char* key, size_t len );
+
+MYLLY_API uint32		hashmap_hash_key		( hashmap_t* map, const void* key );
+MYLLY_API uint32		hashmap_hash_key_n		( hashmap_t* map, const char* key, size_t len );
+MYLLY_API void*			hashmap_insert_h		( hashmap_t* map, const void* key, uint32 hash, const void* data );
+MYLLY_API void*			hashmap_erase_h			( hashmap_t* map, const void* key, uint32 hash );
+MYLLY_API void*			hashmap_find_h			( hashmap_t* map, const void* key, uint32 hash );
+MYLLY_API void*			hashmap_insert_nh		( hashmap_t* map, const char* key, size_t len, uint32 hash, const void* data );
+MYLLY_API void*			hashmap_erase_nh		( hashmap_t* map, const char* key, size_t len, uint32 hash );
+MYLLY_API void*			hashmap_find_nh			( hashmap_t* map, const char* key, size_t len, uint32 hash );
+
+MYLLY_API void			hashmap_find_batch		( hashmap_t* map, const void* const* keys, uint32 count, void** results );
+MYLLY_API void			hashmap_insert_batch	( hashmap_t* map, const void* const* keys, const void* const* data, uint32 count, void** results );
+
 MYLLY_API void			hashmap_clear			( hashmap_t* map );
 MYLLY_API void			hashmap_rehash			( hashmap_t* map, uint32 buckets );
+MYLLY_API void			hashmap_clear_parallel	( hashmap_t* map, uint32 threads );
+MYLLY_API void			hashmap_rehash_parallel	( hashmap_t* map, uint32 buckets, uint32 threads );
+MYLLY_API void			hashmap_set_filter		( hashmap_t* map, uint32 bits_per_key );
+MYLLY_API void			hashmap_set_small_keys	( hashmap_t* map, uint32 size );
+MYLLY_API void			hashmap_reserve			( hashmap_t* map, uint32 count );
+MYLLY_API void			hashmap_shrink_to_fit	( hashmap_t* map );
+
+MYLLY_API hashmap_t*	hashmap_build_from_arrays	( hashmap_engine_t engine, hashmap_key_type_t keys_type, const void* const* keys, const void* const* data, uint32 count, uint32 threads );
+MYLLY_API hashmap_t*	hashmap_freeze			( hashmap_t* map );
+MYLLY_API bool			hashmap_save			( hashmap_t* map, const char* path, data_size_func_t data_size );
+MYLLY_API hashmap_t*	hashmap_open			( const char* path, const hashmap_key_funcs_t* funcs );
+
+MYLLY_API void			hashmap_iter_begin		( hashmap_t* map, hashmap_iter_t* iter );
+MYLLY_API bool			hashmap_iter_next		( hashmap_iter_t* iter );
+
+#ifdef MYLLY_HASHMAP_STATS
+MYLLY_API void			hashmap_get_stats		( hashmap_t* map, hashmap_stats_t* stats );
+MYLLY_API void			hashmap_reset_stats		( hashmap_t* map );
+#endif
+
+MYLLY_API const hashmap_key_funcs_t* hashmap_key_funcs	( hashmap_key_type_t type );
+MYLLY_API void			hashmap_set_key_funcs	( hashmap_t* map, const hashmap_key_funcs_t* funcs );
+MYLLY_API uint32		hashmap_hash_bytes		( const void* data, size_t len, uint64 seed );
 
 __END_DECLS
 
@@ -14,6 +14,14 @@
 #include <assert.h>
 #include <stdlib.h>
 
+#define LIST_POOL_CHUNK_MIN		(64)	// Nodes in the first chunk of a pool
+#define LIST_POOL_CHUNK_MAX		(4096)	// Maximum nodes in a chunk, the chunks double up to this
+
+// A chunk of pooled nodes, the nodes follow the header.
+typedef struct listchunk_s {
+	struct listchunk_s*	next;	// Previously allocated chunk
+} listchunk_t;
+
 /*
  * __list_alloc - An allocator func with further error
  * checking. Exits the app if allocating fails.
@@ -41,6 +49,64 @@ static void __list_free( const void* ptr )
 	free( (void*)ptr );
 }
 
+/*
+ * __list_alloc_node - Allocate a node for the list_data_* functions.
+ * A pooled list takes the node from its pool, refilled a chunk at a time.
+ * @list: The list the node is allocated for
+ * @returns: The node
+ */
+static __inline node_t* __list_alloc_node( list_t* list )
+{
+	listpool_t* pool = list->pool;
+	listchunk_t* chunk;
+	node_t* nodes;
+	node_t* node;
+	uint32 i;
+
+	if ( pool == NULL )
+		return (node_t*)__list_alloc( sizeof(node_t) );
+
+	if ( pool->free_nodes == NULL )
+	{
+		chunk = (listchunk_t*)__list_alloc( sizeof(listchunk_t) + sizeof(node_t) * pool->chunk_nodes );
+		chunk->next = (listchunk_t*)pool->chunks;
+		pool->chunks = chunk;
+
+		nodes = (node_t*)( chunk + 1 );
+
+		for ( i = 0; i < pool->chunk_nodes; i++ )
+		{
+			nodes[i].next = pool->free_nodes;
+			pool->free_nodes = &nodes[i];
+		}
+
+		if ( pool->chunk_nodes < LIST_POOL_CHUNK_MAX )
+			pool->chunk_nodes *= 2;
+	}
+
+	node = pool->free_nodes;
+	pool->free_nodes = node->next;
+
+	return node;
+}
+
+/*
+ * __list_free_node - Free a node created by the list_data_* functions.
+ * @list: The list the node was allocated for
+ * @node: The node
+ */
+static __inline void __list_free_node( list_t* list, node_t* node )
+{
+	if ( list->pool == NULL )
+	{
+		__list_free( node );
+		return;
+	}
+
+	node->next = list->pool->free_nodes;
+	list->pool->free_nodes = node;
+}
+
 /*
  * list_create - Create and initialize a linked list.
  * @returns: the created linked list
@@ -56,6 +122,9 @@ list_t* list_create( void )
 	list->sentinel.data = NULL;
 
 	list->size = 0;
+	list->pool = NULL;
+	list->index = NULL;
+	list->repeats = 0;
 
 	return list;
 }
@@ -77,12 +146,110 @@ void list_destroy( list_t* list )
 		node->next = NULL;
 
 		if ( node->data )
-			__list_free( node );
+			__list_free_node( list, node );
 	}
 
+	if ( list->index )
+		hashmap_destroy( list->index );
+
 	__list_free( list );
 }
 
+/*
+ * list_set_pool - Allocate the nodes of the list_data_* functions from a pool.
+ * A pool may be shared by several lists, and must outlive all of them.
+ * @list: A list without data nodes
+ * @pool: The pool, NULL to allocate the nodes with malloc
+ */
+void list_set_pool( list_t* list, listpool_t* pool )
+{
+	node_t* node;
+
+	assert( list != NULL );
+
+	list_foreach( list, node )
+	{
+		assert( node->data == NULL ); // Data nodes would be freed to the wrong allocator
+	}
+
+	list->pool = pool;
+}
+
+/*
+ * list_set_indexed - Keep an index of the data nodes, making list_data_remove O(1).
+ * The index maps each data pointer to the first node holding it, so an indexed list
+ * removes the same node as a scan would. Data stored more than once makes adding
+ * such data in the middle of the list, and removing or sending to the back its first
+ * node, scan the list for the next node holding it.
+ * @list: The list to manipulate
+ * @indexed: true to build and maintain the index, false to drop it
+ */
+void list_set_indexed( list_t* list, bool indexed )
+{
+	node_t* node;
+
+	assert( list != NULL );
+
+	if ( !indexed )
+	{
+		if ( list->index )
+			hashmap_destroy( list->index );
+
+		list->index = NULL;
+		list->repeats = 0;
+		return;
+	}
+
+	if ( list->index ) return;
+
+	list->index = hashmap_create_ex( list->size, HASHMAP_CHAINED, HASHMAP_KEY_POINTER );
+	list->repeats = 0;
+
+	// Walked backwards so that the first node of repeated data ends up in the index.
+	list_foreach_r( list, node )
+	{
+		if ( node->data && hashmap_insert( list->index, node->data, node ) )
+			list->repeats++;
+	}
+}
+
+/*
+ * listpool_create - Create an empty node pool.
+ * @returns: The created pool
+ */
+listpool_t* listpool_create( void )
+{
+	listpool_t* pool;
+
+	pool = (listpool_t*)__list_alloc( sizeof(*pool) );
+
+	pool->free_nodes = NULL;
+	pool->chunks = NULL;
+	pool->chunk_nodes = LIST_POOL_CHUNK_MIN;
+
+	return pool;
+}
+
+/*
+ * listpool_destroy - Destroy a node pool and every node allocated from it.
+ * The lists using the pool must have been destroyed first.
+ * @pool: The pool to be destroyed
+ */
+void listpool_destroy( listpool_t* pool )
+{
+	listchunk_t *chunk, *next;
+
+	assert( pool != NULL );
+
+	for ( chunk = (listchunk_t*)pool->chunks; chunk; chunk = next )
+	{
+		next = chunk->next;
+		__list_free( chunk );
+	}
+
+	__list_free( pool );
+}
+
 /*
  * __list_add - Add a new node to the list.
  * @list: The list to manipulate
@@ -104,6 +271,93 @@ static __inline void __list_add( list_t* list, node_t* node,
 	list->size++;
 }
 
+/*
+ * __list_index_add - Add a node just linked into an indexed list to the index.
+ * The index keeps the first node holding each data.
+ * @list: The list to manipulate
+ * @node: The new node
+ */
+static void __list_index_add( list_t* list, node_t* node )
+{
+	node_t *first, *tmp;
+
+	first = (node_t*)hashmap_find( list->index, node->data );
+
+	if ( first )
+	{
+		list->repeats++;
+
+		// A node added to the end can't come before the first one, a node added
+		// to the beginning always does, anywhere else the list tells.
+		if ( node->next == &list->sentinel ) return;
+
+		if ( node->prev != &list->sentinel )
+		{
+			for ( tmp = node->next; tmp != &list->sentinel && tmp != first; tmp = tmp->next );
+			if ( tmp != first ) return;
+		}
+	}
+
+	hashmap_insert( list->index, node->data, node );
+}
+
+/*
+ * __list_index_next - Replace the indexed node of data with the next node holding it.
+ * @list: The list to manipulate
+ * @node: The indexed node, being removed or moved away
+ * @next: The node after it before it was unlinked
+ * @returns: true if another node holds the data
+ */
+static bool __list_index_next( list_t* list, node_t* node, node_t* next )
+{
+	node_t* tmp;
+
+	if ( list->repeats == 0 ) return false;
+
+	for ( tmp = next; tmp != &list->sentinel && tmp->data != node->data; tmp = tmp->next );
+
+	if ( tmp == &list->sentinel ) return false;
+
+	hashmap_insert( list->index, tmp->data, tmp );
+	list->repeats--;
+
+	return true;
+}
+
+/*
+ * __list_index_remove - Remove a node unlinked from an indexed list from the index.
+ * @list: The list to manipulate
+ * @node: The unlinked node
+ * @next: The node after it before it was unlinked
+ */
+static void __list_index_remove( list_t* list, node_t* node, node_t* next )
+{
+	if ( hashmap_find( list->index, node->data ) != node )
+	{
+		list->repeats--;
+		return;
+	}
+
+	if ( !__list_index_next( list, node, next ) )
+		hashmap_erase( list->index, node->data );
+}
+
+/*
+ * __list_link - Add a new node to the list and to the index of the list.
+ * @list: The list to manipulate
+ * @node: The new node
+ * @next: Next node
+ * @prev: Previous node
+ */
+static __inline void __list_link( list_t* list, node_t* node,
+								 node_t* prev, node_t* next )
+{
+	__list_add( list, node, prev, next );
+
+	if ( list->index && node->data )
+		__list_index_add( list, node );
+}
+
 /*
  * list_push_back - Add a new node to the end of the list.
  * @list: The list to manipulate
@@ -114,7 +368,7 @@ void list_push_back( list_t* list, node_t* node )
 	assert( list != NULL );
 	assert( node != NULL );
 
-	__list_add( list, node, list->sentinel.prev, &list->sentinel );
+	__list_link( list, node, list->sentinel.prev, &list->sentinel );
 }
 
 /*
@@ -127,7 +381,7 @@ void list_push_front( list_t* list, node_t* node )
 	assert( list != NULL );
 	assert( node != NULL );
 
-	__list_add( list, node, &list->sentinel, list->sentinel.next );
+	__list_link( list, node, &list->sentinel, list->sentinel.next );
 }
 
 /*
@@ -143,15 +397,15 @@ void list_insert( list_t* list, node_t* node, node_t* position )
 
 	if ( position == NULL ) position = &list->sentinel;
 
-	__list_add( list, node, position->prev, position );
+	__list_link( list, node, position->prev, position );
 }
 
 /*
- * __list_remove - Cleans up the nodes links
+ * __list_unlink - Cleans up the nodes links
  * @prev: Previous node
  * @next: Next node
  */
-static __inline node_t* __list_remove( list_t* list, node_t* node,
+static __inline void __list_unlink( list_t* list, node_t* node,
 								   node_t* prev, node_t* next )
 {
 	next->prev = prev;
@@ -163,10 +417,25 @@ static __inline node_t* __list_remove( list_t* list, node_t* node,
 		list->sentinel.next = next;
 
 	list->size--;
+}
+
+/*
+ * __list_remove - Unlinks a node and frees it if it was created for data
+ * @prev: Previous node
+ * @next: Next node
+ * @returns: The unlinked node, or NULL if it was freed
+ */
+static __inline node_t* __list_remove( list_t* list, node_t* node,
+								   node_t* prev, node_t* next )
+{
+	__list_unlink( list, node, prev, next );
 
 	if ( node->data )
 	{
-		__list_free( node );
+		if ( list->index )
+			__list_index_remove( list, node, next );
+
+		__list_free_node( list, node );
 		node = NULL;
 	}
 
@@ -226,14 +495,15 @@ void list_remove( list_t* list, node_t* node )
 
 /*
  * __list_create_node - Creates a new node as a container for the specified data.
+ * @list: The list the node is created for
  * @data: Data to be stored.
  * @returns: Pointer to the new node.
  */
-static __inline node_t* __list_create_node( void* data )
+static __inline node_t* __list_create_node( list_t* list, void* data )
 {
 	node_t* node;
 
-	node = (node_t*)__list_alloc( sizeof(*node) );
+	node = __list_alloc_node( list );
 	node->prev = NULL;
 	node->next = NULL;
 	node->data = data;
@@ -254,9 +524,9 @@ node_t* list_data_push_back( list_t* list, void* data )
 	assert( list != NULL );
 	assert( data != NULL );
 
-	node = __list_create_node( data );
+	node = __list_create_node( list, data );
 
-	__list_add( list, node, list->sentinel.prev, &list->sentinel );
+	__list_link( list, node, list->sentinel.prev, &list->sentinel );
 
 	return node;
 }
@@ -273,9 +543,9 @@ node_t* list_data_push_front( list_t* list, void* data )
 	assert( list != NULL );
 	assert( data != NULL );
 
-	node = __list_create_node( data );
+	node = __list_create_node( list, data );
 
-	__list_add( list, node, &list->sentinel, list->sentinel.next );
+	__list_link( list, node, &list->sentinel, list->sentinel.next );
 
 	return node;
 }
@@ -296,9 +566,9 @@ node_t* list_data_insert( list_t* list, void* data, node_t* position )
 
 	if ( position == NULL ) position = &list->sentinel;
 
-	node = __list_create_node( data );
+	node = __list_create_node( list, data );
 
-	__list_add( list, node, position->prev, position );
+	__list_link( list, node, position->prev, position );
 
 	return node;
 }
@@ -351,6 +621,7 @@ void* list_data_pop_front( list_t* list )
 
 /*
  * list_data_remove - Removes an arbitrary node from the list.
+ * An indexed list finds the node without scanning the list.
  * @list: The list to manipulate
  * @data: Data which should be removed from the list.
  */
@@ -363,6 +634,17 @@ void list_data_remove( list_t* list, void* data )
 	if ( list_empty( list ) ) return;
 	if ( data == NULL ) return;
 
+	if ( list->index )
+	{
+		node = (node_t*)hashmap_find( list->index, data );
+
+		// Every data on the list is in the index, a miss needs no scan.
+		if ( node )
+			__list_remove( list, node, node->prev, node->next );
+
+		return;
+	}
+
 	list_foreach( list, node )
 	{
 		if ( node->data == data ) break;
@@ -425,10 +707,21 @@ void list_move_forward( list_t* list, node_t* node )
  */
 void list_send_to_back( list_t* list, node_t* node )
 {
+	node_t* next;
+
 	assert( list != NULL );
 	assert( node != NULL );
 
-	__list_remove( list, node, node->prev, node->next );
+	next = node->next;
+
+	__list_unlink( list, node, node->prev, next );
+
+	// The first node of repeated data hands its place in the index over to the next one.
+	if ( list->index && list->repeats && node->data &&
+		 hashmap_find( list->index, node->data ) == node &&
+		 __list_index_next( list, node, next ) )
+		list->repeats++;
+
 	__list_add( list, node, list->sentinel.prev, &list->sentinel );
 }
 
@@ -442,6 +735,10 @@ void list_send_to_front( list_t* list, node_t* node )
 	assert( list != NULL );
 	assert( node != NULL );
 
-	__list_remove( list, node, node->prev, node->next );
+	__list_unlink( list, node, node->prev, node->next );
 	__list_add( list, node, &list->sentinel, list->sentinel.next );
+
+	// The node is now the first one holding its data.
+	if ( list->index && list->repeats && node->data )
+		hashmap_insert( list->index, node->data, node );
 }
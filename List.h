@@ -14,6 +14,7 @@
 #define __MYLLY_LIST_H
 
 #include "stdtypes.h"
+#include "HashMap.h"
 
 typedef struct node_t {
 	struct node_t*	next;	// The next node on this list.
@@ -21,9 +22,18 @@ typedef struct node_t {
 	void*			data;	// Pointer to data
 } node_t;
 
+typedef struct {
+	node_t*			free_nodes;	// Returned nodes, linked through their next pointers
+	void*			chunks;		// Chunks the nodes are allocated from
+	uint32			chunk_nodes;// Number of nodes in the next chunk
+} listpool_t;
+
 typedef struct {
 	uint32			size;		// The size of the list
 	struct node_t	sentinel;	// Sentinel node
+	listpool_t*		pool;		// Pool for the nodes of list_data_* functions, NULL to use malloc
+	hashmap_t*		index;		// First node holding each data for list_data_remove, NULL if not indexed
+	uint32			repeats;	// Data nodes left out of the index, because an earlier node holds the same data
 } list_t;
 
 /* Some macros to shorten often used function names */
@@ -73,6 +83,11 @@ __BEGIN_DECLS
 
 MYLLY_API list_t*			list_create					( void );
 MYLLY_API void				list_destroy				( list_t* list );
+MYLLY_API void				list_set_pool				( list_t* list, listpool_t* pool );
+MYLLY_API void				list_set_indexed			( list_t* list, bool indexed );
+
+MYLLY_API listpool_t*		listpool_create				( void );
+MYLLY_API void				listpool_destroy			( listpool_t* pool );
 
 MYLLY_API void				list_push_back				( list_t* list, node_t* node );
 MYLLY_API void				list_push_front				( list_t* list, node_t* node );
@@ -0,0 +1,266 @@
+/**********************************************************************
+ *
+ * PROJECT:		Types library
+ * FILE:		ShardedMap.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		A thread safe hash map split into independent shards.
+ *				Every shard is a hashmap_t with its own lock, node slab
+ *				and key arena, so writers only contend within a shard.
+ *
+ *				(c) Tuomo Jauhiainen 2012
+ *
+ **********************************************************************/
+
+#include "Types/ShardedMap.h"
+#include <malloc.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SHARDMAP_SHARDS_PER_CPU		(4)		// Default number of shards for each processor
+#define SHARDMAP_MAX_SHARDS			(1024)	// Maximum number of shards
+
+/*
+ * __shardmap_alloc - An allocator func with further error
+ * checking. Exits the app if allocating fails.
+ * @arg size: Size to be allocated in bytes
+ * @returns: A pointer to the allocated memory block
+ */
+static void* __shardmap_alloc( size_t size )
+{
+	void* ptr;
+
+	ptr = malloc( size );
+
+	assert( ptr != NULL ); // If we're in debug mode trigger the assertion
+	if ( ptr ) return ptr;
+
+	exit( EXIT_FAILURE ); // Otherwise exit the application just in case
+}
+
+/*
+ * __shardmap_free - A memory freeing func.
+ * @arg ptr: Memory block to be freed.
+ */
+static void __shardmap_free( const void* ptr )
+{
+	free( (void*)ptr );
+}
+
+/*
+ * __shardmap_shard - Select the shard of a key hash. The shard comes from the high
+ * bits of the hash, the buckets of the shard use the low bits, so the keys of a
+ * shard are still spread over all of its buckets.
+ * @arg map: Sharded map
+ * @arg hash: Hash of the key
+ * @returns: The shard holding the key
+ */
+static MYLLY_INLINE shard_t* __shardmap_shard( shardmap_t* map, uint32 hash )
+{
+	return &map->shards[(uint32)( ( (uint64)hash * map->shard_count ) >> 32 )];
+}
+
+/*
+ * shardmap_create - Create a sharded map.
+ * @arg shards: Number of shards, 0 for a few shards per processor
+ * @arg size: Initial number of buckets (or slots) of the whole map, 0 for the default
+ * @arg engine: Storage engine of the shards, see hashmap_create_ex
+ * @arg keys: Type of the keys
+ * @returns: The created map
+ */
+shardmap_t* shardmap_create( uint32 shards, uint32 size, hashmap_engine_t engine, hashmap_key_type_t keys )
+{
+	shardmap_t* map;
+	uint32 i;
+
+	if ( shards == 0 )
+		shards = SHARDMAP_SHARDS_PER_CPU * thread_cpu_count();
+
+	if ( shards > SHARDMAP_MAX_SHARDS )
+		shards = SHARDMAP_MAX_SHARDS;
+
+	assert( sizeof(((shard_t*)0)->lock) + sizeof(((shard_t*)0)->map) <= SHARDMAP_SHARD_SIZE );
+
+	map = __shardmap_alloc( sizeof(*map) );
+
+	map->shard_count = shards;
+	map->shards = __shardmap_alloc( sizeof(shard_t) * shards );
+
+	for ( i = 0; i < shards; i++ )
+	{
+		mutex_init( &map->shards[i].lock );
+		map->shards[i].map = hashmap_create_ex( size / shards, engine, keys );
+	}
+
+	return map;
+}
+
+/*
+ * shardmap_destroy - Destroy a sharded map and every shard of it.
+ * @arg map: The map to be destroyed
+ */
+void shardmap_destroy( shardmap_t* map )
+{
+	uint32 i;
+
+	assert( map != NULL );
+
+	for ( i = 0; i < map->shard_count; i++ )
+	{
+		hashmap_destroy( map->shards[i].map );
+		mutex_destroy( &map->shards[i].lock );
+	}
+
+	__shardmap_free( map->shards );
+	__shardmap_free( map );
+}
+
+/*
+ * shardmap_set_key_funcs - Set custom key functions for every shard.
+ * Must be called before the map is used.
+ * @arg map: Sharded map
+ * @arg funcs: The key functions, see hashmap_set_key_funcs
+ */
+void shardmap_set_key_funcs( shardmap_t* map, const hashmap_key_funcs_t* funcs )
+{
+	uint32 i;
+
+	assert( map != NULL );
+
+	for ( i = 0; i < map->shard_count; i++ )
+		hashmap_set_key_funcs( map->shards[i].map, funcs );
+}
+
+/*
+ * shardmap_set_destructor - Set a destructor for the data of every shard.
+ * Must be called before the map is used.
+ * @arg map: Sharded map
+ * @arg data_destroy: Destructor for the stored data, NULL for none
+ */
+void shardmap_set_destructor( shardmap_t* map, data_destruct_t data_destroy )
+{
+	uint32 i;
+
+	assert( map != NULL );
+
+	for ( i = 0; i < map->shard_count; i++ )
+		map->shards[i].map->data_destroy = data_destroy;
+}
+
+/*
+ * shardmap_insert - Insert a new key-data pair to the map.
+ * If a key exists already, the previous data will be overwritten.
+ * @arg map: Sharded map
+ * @arg key: Pointer to the key value. For pointer keys the pointer itself.
+ * @arg data: The data to be stored
+ * @returns: Previous data assigned to this key, NULL if nothing was stored
+ */
+void* shardmap_insert( shardmap_t* map, const void* key, const void* data )
+{
+	shard_t* shard;
+	uint32 hash;
+	void* old;
+
+	assert( map != NULL );
+
+	// The key is hashed outside the lock, the shard reuses the hash.
+	hash = hashmap_hash_key( map->shards[0].map, key );
+	shard = __shardmap_shard( map, hash );
+
+	mutex_lock( &shard->lock );
+	old = hashmap_insert_h( shard->map, key, hash, data );
+	mutex_unlock( &shard->lock );
+
+	return old;
+}
+
+/*
+ * shardmap_erase - Remove a key and its data from the map.
+ * @arg map: Sharded map
+ * @arg key: Pointer to the key value. For pointer keys the pointer itself.
+ * @returns: Removed data, NULL if nothing was stored or a destructor was called
+ */
+void* shardmap_erase( shardmap_t* map, const void* key )
+{
+	shard_t* shard;
+	uint32 hash;
+	void* data;
+
+	assert( map != NULL );
+
+	hash = hashmap_hash_key( map->shards[0].map, key );
+	shard = __shardmap_shard( map, hash );
+
+	mutex_lock( &shard->lock );
+	data = hashmap_erase_h( shard->map, key, hash );
+	mutex_unlock( &shard->lock );
+
+	return data;
+}
+
+/*
+ * shardmap_find - Find the data matching a key. The shard is locked during the
+ * lookup, because finding a key can move nodes of the shard (incremental rehash).
+ * @arg map: Sharded map
+ * @arg key: Pointer to the key value. For pointer keys the pointer itself.
+ * @returns: Found data, or NULL if no data was found
+ */
+void* shardmap_find( shardmap_t* map, const void* key )
+{
+	shard_t* shard;
+	uint32 hash;
+	void* data;
+
+	assert( map != NULL );
+
+	hash = hashmap_hash_key( map->shards[0].map, key );
+	shard = __shardmap_shard( map, hash );
+
+	mutex_lock( &shard->lock );
+	data = hashmap_find_h( shard->map, key, hash );
+	mutex_unlock( &shard->lock );
+
+	return data;
+}
+
+/*
+ * shardmap_clear - Remove all entries from every shard. The shards are cleared
+ * one at a time, so entries inserted concurrently into a shard that has already
+ * been cleared are kept.
+ * @arg map: Sharded map
+ */
+void shardmap_clear( shardmap_t* map )
+{
+	uint32 i;
+
+	assert( map != NULL );
+
+	for ( i = 0; i < map->shard_count; i++ )
+	{
+		mutex_lock( &map->shards[i].lock );
+		hashmap_clear( map->shards[i].map );
+		mutex_unlock( &map->shards[i].lock );
+	}
+}
+
+/*
+ * shardmap_size - Count the entries of every shard. Concurrent writers may change
+ * the shards while they are counted, so the result is only exact when there are none.
+ * @arg map: Sharded map
+ * @returns: Number of entries stored
+ */
+uint32 shardmap_size( shardmap_t* map )
+{
+	uint32 i, size;
+
+	assert( map != NULL );
+
+	for ( i = 0, size = 0; i < map->shard_count; i++ )
+	{
+		mutex_lock( &map->shards[i].lock );
+		size += map->shards[i].map->size;
+		mutex_unlock( &map->shards[i].lock );
+	}
+
+	return size;
+}
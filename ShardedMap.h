@@ -0,0 +1,53 @@
+/**********************************************************************
+ *
+ * PROJECT:		Types library
+ * FILE:		ShardedMap.h
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		A thread safe hash map split into independent shards.
+ *				Every shard is a hashmap_t with its own lock, node slab
+ *				and key arena, so writers only contend within a shard.
+ *
+ *				(c) Tuomo Jauhiainen 2012
+ *
+ **********************************************************************/
+
+#pragma once
+#ifndef __MYLLY_SHARDEDMAP_H
+#define __MYLLY_SHARDEDMAP_H
+
+#include "stdtypes.h"
+#include "HashMap.h"
+#include "Thread.h"
+
+#define SHARDMAP_SHARD_SIZE		(128)	// Size of a shard, keeps the locks of the shards on separate cache lines
+
+typedef union {
+	struct {
+		mutex_t				lock;		// Protects the map of this shard
+		hashmap_t*			map;		// The shard itself
+	};
+	uint8					padding[SHARDMAP_SHARD_SIZE];
+} shard_t;
+
+typedef struct {
+	uint32					shard_count;// Number of shards
+	shard_t*				shards;		// The shards, selected by the high bits of the key hash
+} shardmap_t;
+
+__BEGIN_DECLS
+
+MYLLY_API shardmap_t*		shardmap_create			( uint32 shards, uint32 size, hashmap_engine_t engine, hashmap_key_type_t keys );
+MYLLY_API void				shardmap_destroy		( shardmap_t* map );
+
+MYLLY_API void				shardmap_set_key_funcs	( shardmap_t* map, const hashmap_key_funcs_t* funcs );
+MYLLY_API void				shardmap_set_destructor	( shardmap_t* map, data_destruct_t data_destroy );
+
+MYLLY_API void*				shardmap_insert			( shardmap_t* map, const void* key, const void* data );
+MYLLY_API void*				shardmap_erase			( shardmap_t* map, const void* key );
+MYLLY_API void*				shardmap_find			( shardmap_t* map, const void* key );
+MYLLY_API void				shardmap_clear			( shardmap_t* map );
+MYLLY_API uint32			shardmap_size			( shardmap_t* map );
+
+__END_DECLS
+
+#endif /* __MYLLY_SHARDEDMAP_H */
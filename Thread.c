@@ -0,0 +1,182 @@
+/**********************************************************************
+ *
+ * PROJECT:		Types library
+ * FILE:		Thread.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Portable threads, mutexes and atomic operations used by
+ *				the thread safe containers.
+ *
+ *				(c) Tuomo Jauhiainen 2012
+ *
+ **********************************************************************/
+
+#include "Types/Thread.h"
+#include <malloc.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+	#include <unistd.h>
+#endif
+
+typedef struct {
+	thread_func_t	func;		// The function to run
+	void*			arg;		// Argument passed to the function
+} thread_start_t;
+
+/*
+ * __thread_alloc - An allocator func with further error
+ * checking. Exits the app if allocating fails.
+ * @arg size: Size to be allocated in bytes
+ * @returns: A pointer to the allocated memory block
+ */
+static void* __thread_alloc( size_t size )
+{
+	void* ptr;
+
+	ptr = malloc( size );
+
+	assert( ptr != NULL ); // If we're in debug mode trigger the assertion
+	if ( ptr ) return ptr;
+
+	exit( EXIT_FAILURE ); // Otherwise exit the application just in case
+}
+
+/*
+ * mutex_init - Initialize a mutex.
+ * @mutex: The mutex to be initialized
+ */
+void mutex_init( mutex_t* mutex )
+{
+#ifdef _WIN32
+	InitializeCriticalSection( mutex );
+#else
+	pthread_mutex_init( mutex, NULL );
+#endif
+}
+
+/*
+ * mutex_destroy - Release the resources of a mutex.
+ * @mutex: The mutex to be destroyed
+ */
+void mutex_destroy( mutex_t* mutex )
+{
+#ifdef _WIN32
+	DeleteCriticalSection( mutex );
+#else
+	pthread_mutex_destroy( mutex );
+#endif
+}
+
+/*
+ * mutex_lock - Lock a mutex, blocking until it becomes available.
+ * @mutex: The mutex to be locked
+ */
+void mutex_lock( mutex_t* mutex )
+{
+#ifdef _WIN32
+	EnterCriticalSection( mutex );
+#else
+	pthread_mutex_lock( mutex );
+#endif
+}
+
+/*
+ * mutex_unlock - Unlock a mutex locked by this thread.
+ * @mutex: The mutex to be unlocked
+ */
+void mutex_unlock( mutex_t* mutex )
+{
+#ifdef _WIN32
+	LeaveCriticalSection( mutex );
+#else
+	pthread_mutex_unlock( mutex );
+#endif
+}
+
+/*
+ * __thread_start - Platform specific entry point of new threads.
+ * @arg: The thread_start_t describing the thread
+ */
+#ifdef _WIN32
+static DWORD WINAPI __thread_start( LPVOID arg )
+#else
+static void* __thread_start( void* arg )
+#endif
+{
+	thread_start_t start;
+
+	start = *(thread_start_t*)arg;
+	free( arg );
+
+	start.func( start.arg );
+
+#ifdef _WIN32
+	return 0;
+#else
+	return NULL;
+#endif
+}
+
+/*
+ * thread_create - Start a new thread.
+ * @func: The function to run in the new thread
+ * @arg: Argument passed to the function
+ * @returns: Handle of the thread, which must be passed to thread_join
+ */
+thread_t thread_create( thread_func_t func, void* arg )
+{
+	thread_start_t* start;
+	thread_t thread;
+
+	assert( func != NULL );
+
+	start = __thread_alloc( sizeof(*start) );
+	start->func = func;
+	start->arg = arg;
+
+#ifdef _WIN32
+	thread = CreateThread( NULL, 0, __thread_start, start, 0, NULL );
+	assert( thread != NULL );
+#else
+	if ( pthread_create( &thread, NULL, __thread_start, start ) != 0 )
+	{
+		assert( false );
+		exit( EXIT_FAILURE );
+	}
+#endif
+
+	return thread;
+}
+
+/*
+ * thread_join - Wait for a thread to finish and release its handle.
+ * @thread: The thread to wait for
+ */
+void thread_join( thread_t thread )
+{
+#ifdef _WIN32
+	WaitForSingleObject( thread, INFINITE );
+	CloseHandle( thread );
+#else
+	pthread_join( thread, NULL );
+#endif
+}
+
+/*
+ * thread_cpu_count - Get the number of logical processors.
+ * @returns: Number of processors, at least 1
+ */
+uint32 thread_cpu_count( void )
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo( &info );
+
+	return info.dwNumberOfProcessors ? (uint32)info.dwNumberOfProcessors : 1;
+#else
+	long count = sysconf( _SC_NPROCESSORS_ONLN );
+
+	return count > 0 ? (uint32)count : 1;
+#endif
+}
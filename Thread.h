@@ -0,0 +1,135 @@
+/**********************************************************************
+ *
+ * PROJECT:		Types library
+ * FILE:		Thread.h
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		Portable threads, mutexes and atomic operations used by
+ *				the thread safe containers.
+ *
+ *				(c) Tuomo Jauhiainen 2012
+ *
+ **********************************************************************/
+
+#pragma once
+#ifndef __MYLLY_THREAD_H
+#define __MYLLY_THREAD_H
+
+#include "stdtypes.h"
+
+#ifdef _WIN32
+	typedef CRITICAL_SECTION	mutex_t;
+	typedef HANDLE				thread_t;
+	#define MYLLY_THREAD_LOCAL	__declspec(thread)
+#else
+	#include <pthread.h>
+	typedef pthread_mutex_t		mutex_t;
+	typedef pthread_t			thread_t;
+	#define MYLLY_THREAD_LOCAL	__thread
+#endif
+
+typedef void ( *thread_func_t )( void* );
+
+/*
+ * Atomic operations. Loads have acquire and stores release semantics,
+ * read-modify-write operations are sequentially consistent.
+ */
+#ifdef _MSC_VER
+
+static MYLLY_INLINE void* atomic_load_ptr( void* volatile* ptr )
+{
+	return InterlockedCompareExchangePointer( ptr, NULL, NULL );
+}
+
+static MYLLY_INLINE void atomic_store_ptr( void* volatile* ptr, void* value )
+{
+	InterlockedExchangePointer( ptr, value );
+}
+
+static MYLLY_INLINE bool atomic_cas_ptr( void* volatile* ptr, void* expected, void* value )
+{
+	return InterlockedCompareExchangePointer( ptr, value, expected ) == expected;
+}
+
+static MYLLY_INLINE uint32 atomic_load_u32( volatile uint32* ptr )
+{
+	return (uint32)InterlockedCompareExchange( (volatile LONG*)ptr, 0, 0 );
+}
+
+static MYLLY_INLINE void atomic_store_u32( volatile uint32* ptr, uint32 value )
+{
+	InterlockedExchange( (volatile LONG*)ptr, (LONG)value );
+}
+
+static MYLLY_INLINE bool atomic_cas_u32( volatile uint32* ptr, uint32 expected, uint32 value )
+{
+	return (uint32)InterlockedCompareExchange( (volatile LONG*)ptr, (LONG)value, (LONG)expected ) == expected;
+}
+
+static MYLLY_INLINE uint32 atomic_add_u32( volatile uint32* ptr, int32 value )
+{
+	return (uint32)InterlockedExchangeAdd( (volatile LONG*)ptr, value ) + value;
+}
+
+static MYLLY_INLINE void atomic_fence( void )
+{
+	MemoryBarrier();
+}
+
+#else
+
+static MYLLY_INLINE void* atomic_load_ptr( void* volatile* ptr )
+{
+	return __atomic_load_n( ptr, __ATOMIC_ACQUIRE );
+}
+
+static MYLLY_INLINE void atomic_store_ptr( void* volatile* ptr, void* value )
+{
+	__atomic_store_n( ptr, value, __ATOMIC_RELEASE );
+}
+
+static MYLLY_INLINE bool atomic_cas_ptr( void* volatile* ptr, void* expected, void* value )
+{
+	return __atomic_compare_exchange_n( ptr, &expected, value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+
+static MYLLY_INLINE uint32 atomic_load_u32( volatile uint32* ptr )
+{
+	return __atomic_load_n( ptr, __ATOMIC_ACQUIRE );
+}
+
+static MYLLY_INLINE void atomic_store_u32( volatile uint32* ptr, uint32 value )
+{
+	__atomic_store_n( ptr, value, __ATOMIC_RELEASE );
+}
+
+static MYLLY_INLINE bool atomic_cas_u32( volatile uint32* ptr, uint32 expected, uint32 value )
+{
+	return __atomic_compare_exchange_n( ptr, &expected, value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+
+static MYLLY_INLINE uint32 atomic_add_u32( volatile uint32* ptr, int32 value )
+{
+	return __atomic_add_fetch( ptr, (uint32)value, __ATOMIC_SEQ_CST );
+}
+
+static MYLLY_INLINE void atomic_fence( void )
+{
+	__atomic_thread_fence( __ATOMIC_SEQ_CST );
+}
+
+#endif /* _MSC_VER */
+
+__BEGIN_DECLS
+
+MYLLY_API void				mutex_init				( mutex_t* mutex );
+MYLLY_API void				mutex_destroy			( mutex_t* mutex );
+MYLLY_API void				mutex_lock				( mutex_t* mutex );
+MYLLY_API void				mutex_unlock			( mutex_t* mutex );
+
+MYLLY_API thread_t			thread_create			( thread_func_t func, void* arg );
+MYLLY_API void				thread_join				( thread_t thread );
+MYLLY_API uint32			thread_cpu_count		( void );
+
+__END_DECLS
+
+#endif /* __MYLLY_THREAD_H */
@@ -64,7 +64,6 @@ tree_t* tree_create( void (*destructor)( void* ) )
 	tree->null.left = tree->null.right = &tree->null;
 
 	tree->root = &tree->null;
-	tree->deleted = NULL;
 	tree->size = 0;
 	tree->destructor = destructor ? destructor : __tree_node_destructor;
 
@@ -234,7 +233,7 @@ void tree_insert( tree_t* tree, uint32 key, tnode_t* data )
 }
 
 /*
- * __tree_remove - A recursive subroutine to remove a node
+ * __tree_remove - A recursive subroutine to unlink a node
  * @tree: The tree to remove from
  * @root: The root node of the tree
  * @key: Key matching the node to be removed
@@ -242,9 +241,11 @@ void tree_insert( tree_t* tree, uint32 key, tnode_t* data )
  */
 static tnode_t* __tree_remove( tree_t* tree, tnode_t* root, uint32 key )
 {
-	if ( root == &tree->null ) return root;
+	tnode_t* null = &tree->null;
+	tnode_t* next;
+	uint32 level;
 
-	tree->last = root;
+	if ( root == null ) return root;
 
 	if ( key < root->key )
 	{
@@ -254,35 +255,55 @@ static tnode_t* __tree_remove( tree_t* tree, tnode_t* root, uint32 key )
 	{
 		root->right = __tree_remove( tree, root->right, key );
 	}
+	else if ( root->left == null && root->right == null )
+	{
+		return null;
+	}
 	else
-		tree->deleted = root;
-
-	if ( root == tree->last &&
-		 tree->deleted != &tree->null &&
-		 key == tree->deleted->key )
 	{
-		tree->deleted->key = root->key;
-		tree->deleted = &tree->null;
-		root = root->right;
-
-		tree->destructor( tree->last );
-		tree->size--;
+		// Move the successor (or the predecessor) to the place of the removed node
+		// instead of copying its key, so the data embedded after each node stays
+		// with its key.
+		if ( root->left == null )
+		{
+			for ( next = root->right; next->left != null; next = next->left );
+
+			next->right = __tree_remove( tree, root->right, next->key );
+			next->left = null;
+		}
+		else
+		{
+			for ( next = root->left; next->right != null; next = next->right );
+
+			next->left = __tree_remove( tree, root->left, next->key );
+			next->right = root->right;
+		}
+
+		next->level = root->level;
+		root = next;
 	}
 
-	else if ( root->left->level < root->level - 1 ||
-		      root->right->level < root->level - 1 )
+	// Rebalance the tree on the way up
+	level = ( root->left->level < root->right->level ? root->left->level : root->right->level ) + 1;
+
+	if ( level < root->level )
 	{
-		root->level--;
+		root->level = level;
 
-		if ( root->right->level > root->level )
-			root->right->level = root->level;
+		if ( level < root->right->level )
+			root->right->level = level;
+	}
+
+	root = __tree_skew( root );
+	root->right = __tree_skew( root->right );
 
-		root = __tree_skew( root );
-		root->right = __tree_skew( root->right );
+	if ( root->right != null )
 		root->right->right = __tree_skew( root->right->right );
-		root = __tree_split( root );
+
+	root = __tree_split( root );
+
+	if ( root->right != null )
 		root->right = __tree_split( root->right );
-	}
 
 	return root;
 }
@@ -294,5 +315,15 @@ static tnode_t* __tree_remove( tree_t* tree, tnode_t* root, uint32 key )
  */
 void tree_remove( tree_t* tree, uint32 key )
 {
+	tnode_t* node;
+
+	assert( tree != NULL );
+
+	node = tree_find( tree, key );
+	if ( node == NULL ) return;
+
 	tree->root = __tree_remove( tree, tree->root, key );
+	tree->size--;
+
+	tree->destructor( node );
 }
@@ -27,8 +27,6 @@ typedef struct tnode_t
 typedef struct tree_t
 {
 	tnode_t*		root;		// Root node
-	tnode_t*		deleted;	// Temp recursive pointer
-	tnode_t*		last;		// Temp recursive pointer
 	tnode_t			null;		// A null node
 	uint32			size;		// Entry count
 
@@ -0,0 +1,440 @@
+/**********************************************************************
+ *
+ * PROJECT:		Types library
+ * FILE:		UnrolledList.c
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		An unrolled linked list. The data pointers are stored
+ *				in cache line aligned chunks, so scanning the list
+ *				reads them sequentially instead of chasing a node for
+ *				every element.
+ *
+ *				(c) Tuomo Jauhiainen 2012
+ *
+ **********************************************************************/
+
+#include "Types/UnrolledList.h"
+#include <malloc.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Neighbouring chunks holding no more items than this together are merged.
+#define ULIST_MERGE_ITEMS	( ULIST_CHUNK_ITEMS * 3 / 4 )
+
+/*
+ * __ulist_alloc - An allocator func with further error
+ * checking. Exits the app if allocating fails.
+ * @arg size: Size to be allocated in bytes
+ * @returns: A pointer to the allocated memory block
+ */
+static void* __ulist_alloc( size_t size )
+{
+	void* ptr;
+
+	ptr = malloc( size );
+
+	assert( ptr != NULL ); // If we're in debug mode trigger the assertion
+	if ( ptr ) return ptr;
+
+	exit( EXIT_FAILURE ); // Otherwise exit the application just in case
+}
+
+/*
+ * __ulist_free - A memory freeing func.
+ * @arg ptr: Memory block to be freed.
+ */
+static void __ulist_free( const void* ptr )
+{
+	free( (void*)ptr );
+}
+
+/*
+ * __ulist_chunk_create - Allocate an empty chunk aligned to a cache line
+ * and link it after another chunk.
+ * @list: The list to manipulate
+ * @prev: The chunk to link the new one after, NULL to make it the first chunk
+ * @first: Index of the first item of the new chunk
+ * @returns: The new chunk
+ */
+static ulistchunk_t* __ulist_chunk_create( ulist_t* list, ulistchunk_t* prev, uint32 first )
+{
+	void* ptr;
+	ulistchunk_t* chunk;
+
+#ifdef _WIN32
+	ptr = _aligned_malloc( sizeof(ulistchunk_t), ULIST_CHUNK_ALIGN );
+#else
+	if ( posix_memalign( &ptr, ULIST_CHUNK_ALIGN, sizeof(ulistchunk_t) ) != 0 ) ptr = NULL;
+#endif
+
+	assert( ptr != NULL ); // If we're in debug mode trigger the assertion
+	if ( !ptr ) exit( EXIT_FAILURE ); // Otherwise exit the application just in case
+
+	chunk = (ulistchunk_t*)ptr;
+	chunk->first = (uint16)first;
+	chunk->count = 0;
+	chunk->prev = prev;
+	chunk->next = prev ? prev->next : list->head;
+
+	if ( chunk->next ) chunk->next->prev = chunk;
+	else list->tail = chunk;
+
+	if ( prev ) prev->next = chunk;
+	else list->head = chunk;
+
+	return chunk;
+}
+
+/*
+ * __ulist_chunk_free - Unlink a chunk from the list and free it.
+ * @list: The list to manipulate
+ * @chunk: The chunk to be freed
+ */
+static void __ulist_chunk_free( ulist_t* list, ulistchunk_t* chunk )
+{
+	if ( chunk->prev ) chunk->prev->next = chunk->next;
+	else list->head = chunk->next;
+
+	if ( chunk->next ) chunk->next->prev = chunk->prev;
+	else list->tail = chunk->prev;
+
+#ifdef _WIN32
+	_aligned_free( chunk );
+#else
+	free( chunk );
+#endif
+}
+
+/*
+ * __ulist_chunk_move - Move the items of a chunk to start from another index.
+ * @chunk: The chunk
+ * @first: The new index of the first item
+ */
+static __inline void __ulist_chunk_move( ulistchunk_t* chunk, uint32 first )
+{
+	memmove( &chunk->items[first], &chunk->items[chunk->first], sizeof(void*) * chunk->count );
+	chunk->first = (uint16)first;
+}
+
+/*
+ * __ulist_merge - Move the items of a chunk to the end of the previous chunk
+ * and free the emptied chunk.
+ * @list: The list to manipulate
+ * @chunk: The chunk to be merged into its previous chunk
+ */
+static void __ulist_merge( ulist_t* list, ulistchunk_t* chunk )
+{
+	ulistchunk_t* prev = chunk->prev;
+
+	__ulist_chunk_move( prev, 0 );
+
+	memcpy( &prev->items[prev->count], &chunk->items[chunk->first], sizeof(void*) * chunk->count );
+	prev->count = (uint16)( prev->count + chunk->count );
+
+	__ulist_chunk_free( list, chunk );
+}
+
+/*
+ * __ulist_split - Move the upper half of the items of a full chunk into a new chunk.
+ * @list: The list to manipulate
+ * @chunk: The full chunk
+ * @returns: The new chunk, linked after the split one
+ */
+static ulistchunk_t* __ulist_split( ulist_t* list, ulistchunk_t* chunk )
+{
+	ulistchunk_t* next;
+	uint32 keep;
+
+	keep = chunk->count / 2;
+	next = __ulist_chunk_create( list, chunk, 0 );
+
+	next->count = (uint16)( chunk->count - keep );
+	memcpy( next->items, &chunk->items[chunk->first + keep], sizeof(void*) * next->count );
+
+	chunk->count = (uint16)keep;
+
+	return next;
+}
+
+/*
+ * __ulist_remove_item - Remove an item from a chunk. The shorter side of the
+ * chunk is moved over the gap, emptied and sparse chunks are freed or merged.
+ * @list: The list to manipulate
+ * @chunk: The chunk holding the item
+ * @pos: Position of the item in the chunk, counted from the first item
+ */
+static void __ulist_remove_item( ulist_t* list, ulistchunk_t* chunk, uint32 pos )
+{
+	void** items = &chunk->items[chunk->first];
+
+	if ( pos < (uint32)chunk->count / 2 )
+	{
+		memmove( &items[1], &items[0], sizeof(void*) * pos );
+		chunk->first++;
+	}
+	else
+	{
+		memmove( &items[pos], &items[pos+1], sizeof(void*) * ( chunk->count - pos - 1 ) );
+	}
+
+	chunk->count--;
+	list->size--;
+
+	if ( chunk->count == 0 )
+		__ulist_chunk_free( list, chunk );
+
+	else if ( chunk->next && chunk->count + chunk->next->count <= ULIST_MERGE_ITEMS )
+		__ulist_merge( list, chunk->next );
+
+	else if ( chunk->prev && chunk->prev->count + chunk->count <= ULIST_MERGE_ITEMS )
+		__ulist_merge( list, chunk );
+}
+
+/*
+ * ulist_create - Create and initialize an unrolled list.
+ * @returns: the created list
+ */
+ulist_t* ulist_create( void )
+{
+	ulist_t* list;
+
+	list = (ulist_t*)__ulist_alloc( sizeof(*list) );
+
+	list->size = 0;
+	list->head = NULL;
+	list->tail = NULL;
+
+	return list;
+}
+
+/*
+ * ulist_destroy - Destroy a previously created list.
+ * @list: A list to be destroyed
+ */
+void ulist_destroy( ulist_t* list )
+{
+	assert( list != NULL );
+
+	ulist_clear( list );
+
+	__ulist_free( list );
+}
+
+/*
+ * ulist_clear - Remove every item from the list.
+ * @list: The list to manipulate
+ */
+void ulist_clear( ulist_t* list )
+{
+	assert( list != NULL );
+
+	while ( list->head )
+		__ulist_chunk_free( list, list->head );
+
+	list->size = 0;
+}
+
+/*
+ * ulist_push_back - Add data to the end of the list.
+ * @list: The list to manipulate
+ * @data: The data to be added
+ */
+void ulist_push_back( ulist_t* list, void* data )
+{
+	ulistchunk_t* chunk;
+
+	assert( list != NULL );
+	assert( data != NULL );
+
+	chunk = list->tail;
+
+	if ( !chunk || chunk->first + chunk->count == ULIST_CHUNK_ITEMS )
+	{
+		// Items popped from the front leave room at the start of the chunk.
+		if ( chunk && chunk->count < ULIST_CHUNK_ITEMS )
+			__ulist_chunk_move( chunk, 0 );
+		else
+			chunk = __ulist_chunk_create( list, chunk, 0 );
+	}
+
+	chunk->items[chunk->first + chunk->count] = data;
+	chunk->count++;
+	list->size++;
+}
+
+/*
+ * ulist_push_front - Add data to the beginning of the list.
+ * @list: The list to manipulate
+ * @data: The data to be added
+ */
+void ulist_push_front( ulist_t* list, void* data )
+{
+	ulistchunk_t* chunk;
+
+	assert( list != NULL );
+	assert( data != NULL );
+
+	chunk = list->head;
+
+	if ( !chunk || chunk->first == 0 )
+	{
+		// A new first chunk is filled from its end, so further pushes need no moves.
+		if ( chunk && chunk->count < ULIST_CHUNK_ITEMS )
+			__ulist_chunk_move( chunk, ULIST_CHUNK_ITEMS - chunk->count );
+		else
+			chunk = __ulist_chunk_create( list, NULL, ULIST_CHUNK_ITEMS );
+	}
+
+	chunk->first--;
+	chunk->items[chunk->first] = data;
+	chunk->count++;
+	list->size++;
+}
+
+/*
+ * ulist_insert - Insert data at a position of the list.
+ * @list: The list to manipulate
+ * @data: The data to be added
+ * @position: Index the data will have in the list, the size of the list to add it to the end
+ */
+void ulist_insert( ulist_t* list, void* data, uint32 position )
+{
+	ulistchunk_t* chunk;
+	void** items;
+
+	assert( list != NULL );
+	assert( data != NULL );
+	assert( position <= list->size );
+
+	if ( position == list->size ) { ulist_push_back( list, data ); return; }
+	if ( position == 0 ) { ulist_push_front( list, data ); return; }
+
+	// Walk to the chunk holding the position from the closer end of the list.
+	if ( position <= list->size / 2 )
+	{
+		for ( chunk = list->head; position > chunk->count; chunk = chunk->next )
+			position -= chunk->count;
+	}
+	else
+	{
+		position = list->size - position;
+
+		for ( chunk = list->tail; position > chunk->count; chunk = chunk->prev )
+			position -= chunk->count;
+
+		position = chunk->count - position;
+	}
+
+	if ( chunk->count == ULIST_CHUNK_ITEMS )
+	{
+		if ( position > chunk->count / 2 )
+		{
+			position -= chunk->count / 2;
+			chunk = __ulist_split( list, chunk );
+		}
+		else
+		{
+			__ulist_split( list, chunk );
+		}
+	}
+
+	if ( chunk->first + chunk->count == ULIST_CHUNK_ITEMS )
+	{
+		// No room after the items, move the items before the position down.
+		items = &chunk->items[chunk->first];
+
+		memmove( &items[-1], &items[0], sizeof(void*) * position );
+		chunk->first--;
+	}
+	else
+	{
+		items = &chunk->items[chunk->first];
+
+		memmove( &items[position+1], &items[position], sizeof(void*) * ( chunk->count - position ) );
+	}
+
+	chunk->items[chunk->first + position] = data;
+	chunk->count++;
+	list->size++;
+}
+
+/*
+ * ulist_pop_back - Remove data from the end of the list.
+ * @list: The list to manipulate
+ * @returns: The removed data, or NULL if there was nothing to remove.
+ */
+void* ulist_pop_back( ulist_t* list )
+{
+	ulistchunk_t* chunk;
+	void* data;
+
+	assert( list != NULL );
+
+	if ( ulist_empty( list ) ) return NULL;
+
+	chunk = list->tail;
+	data = chunk->items[chunk->first + chunk->count - 1];
+
+	chunk->count--;
+	list->size--;
+
+	if ( chunk->count == 0 )
+		__ulist_chunk_free( list, chunk );
+
+	return data;
+}
+
+/*
+ * ulist_pop_front - Remove data from the beginning of the list.
+ * @list: The list to manipulate
+ * @returns: The removed data, or NULL if there was nothing to remove.
+ */
+void* ulist_pop_front( ulist_t* list )
+{
+	ulistchunk_t* chunk;
+	void* data;
+
+	assert( list != NULL );
+
+	if ( ulist_empty( list ) ) return NULL;
+
+	chunk = list->head;
+	data = chunk->items[chunk->first];
+
+	chunk->first++;
+	chunk->count--;
+	list->size--;
+
+	if ( chunk->count == 0 )
+		__ulist_chunk_free( list, chunk );
+
+	return data;
+}
+
+/*
+ * ulist_remove - Remove the first occurrence of data from the list.
+ * @list: The list to manipulate
+ * @data: Data which should be removed from the list.
+ */
+void ulist_remove( ulist_t* list, void* data )
+{
+	ulistchunk_t* chunk;
+	uint32 i;
+
+	assert( list != NULL );
+
+	if ( ulist_empty( list ) ) return;
+	if ( data == NULL ) return;
+
+	for ( chunk = list->head; chunk; chunk = chunk->next )
+	{
+		for ( i = chunk->first; i < (uint32)chunk->first + chunk->count; i++ )
+		{
+			if ( chunk->items[i] == data )
+			{
+				__ulist_remove_item( list, chunk, i - chunk->first );
+				return;
+			}
+		}
+	}
+}
@@ -0,0 +1,80 @@
+/**********************************************************************
+ *
+ * PROJECT:		Types library
+ * FILE:		UnrolledList.h
+ * LICENCE:		See Licence.txt
+ * PURPOSE:		An unrolled linked list. The data pointers are stored
+ *				in cache line aligned chunks, so scanning the list
+ *				reads them sequentially instead of chasing a node for
+ *				every element.
+ *
+ *				(c) Tuomo Jauhiainen 2012
+ *
+ **********************************************************************/
+
+#pragma once
+#ifndef __MYLLY_UNROLLEDLIST_H
+#define __MYLLY_UNROLLEDLIST_H
+
+#include "stdtypes.h"
+
+#define ULIST_CHUNK_SIZE	(256)	// Size of a chunk in bytes, a multiple of the cache line size
+#define ULIST_CHUNK_ALIGN	(64)	// Alignment of the chunks
+
+// Number of data pointers in a chunk, the rest of the chunk is taken by the chunk header.
+#define ULIST_CHUNK_ITEMS	( ( ULIST_CHUNK_SIZE - 3 * sizeof(void*) ) / sizeof(void*) )
+
+typedef struct ulistchunk_s {
+	struct ulistchunk_s*	next;		// The next chunk on this list
+	struct ulistchunk_s*	prev;		// The previous chunk
+	uint16					first;		// Index of the first item in use
+	uint16					count;		// Number of items in use, they are kept next to each other
+	void*					items[ULIST_CHUNK_ITEMS]; // Pointers to data
+} ulistchunk_t;
+
+typedef struct {
+	uint32					size;		// The size of the list
+	ulistchunk_t*			head;		// The first chunk
+	ulistchunk_t*			tail;		// The last chunk
+} ulist_t;
+
+#define ulist_empty(list)			( list->size == 0 )
+#define ulist_item(chunk,i)			chunk->items[i]
+
+/*
+ * ulist_foreach - A macro to loop through every item. The loop is nested,
+ * so break only leaves the current chunk.
+ * @list: The list to loop through
+ * @chunk: A ulistchunk_t loop variable
+ * @i: A uint32 loop variable, the index of the item in the chunk
+ */
+#define ulist_foreach(list,chunk,i)                                  \
+	for ( chunk = list->head; chunk; chunk = chunk->next )           \
+		for ( i = chunk->first; i < (uint32)chunk->first + chunk->count; i++ ) \
+
+/*
+ * ulist_foreach_r - A macro to loop through every item in reversed order
+ * @list: The list to loop through
+ * @chunk: A ulistchunk_t loop variable
+ * @i: A uint32 loop variable, the index of the item in the chunk
+ */
+#define ulist_foreach_r(list,chunk,i)                                \
+	for ( chunk = list->tail; chunk; chunk = chunk->prev )           \
+		for ( i = (uint32)chunk->first + chunk->count; i-- > chunk->first; ) \
+
+__BEGIN_DECLS
+
+MYLLY_API ulist_t*			ulist_create				( void );
+MYLLY_API void				ulist_destroy				( ulist_t* list );
+MYLLY_API void				ulist_clear					( ulist_t* list );
+
+MYLLY_API void				ulist_push_back				( ulist_t* list, void* data );
+MYLLY_API void				ulist_push_front			( ulist_t* list, void* data );
+MYLLY_API void				ulist_insert				( ulist_t* list, void* data, uint32 position );
+MYLLY_API void*				ulist_pop_back				( ulist_t* list );
+MYLLY_API void*				ulist_pop_front				( ulist_t* list );
+MYLLY_API void				ulist_remove				( ulist_t* list, void* data );
+
+__END_DECLS
+
+#endif /* __MYLLY_UNROLLEDLIST_H */